@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "server.h"
+
+#define CATALOG_EVENTS_OFFSET 128
+
+_Static_assert(sizeof(CatalogHeader) <= CATALOG_EVENTS_OFFSET, "catalog header overlaps the events");
+_Static_assert(CATALOG_EVENTS_OFFSET % _Alignof(uint32_t) == 0, "events of a compiled catalog are misaligned");
+
+// Sizes of the arrays of a compiled catalog, stored one after another in the order of the fields.
+static size_t catalog_arrays_size(size_t count) {
+    return count * (2 * sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+}
+
+// Arrays with room for the largest catalog, the pages past the events in use are never touched.
+static Catalog allocate_catalog(void) {
+    return (Catalog) { .tickets = safe_malloc(MAX_EVENTS * sizeof(_Atomic uint16_t)),
+                       .ticket_count_offsets = safe_malloc(MAX_EVENTS * sizeof(uint32_t)),
+                       .page_ticket_count_offsets = safe_malloc(MAX_EVENTS * sizeof(uint32_t)),
+                       .description_offsets = safe_malloc(MAX_EVENTS * sizeof(uint32_t)),
+                       .description_lengths = safe_malloc(MAX_EVENTS * sizeof(uint8_t)),
+                       .count = 0, .descriptions = NULL, .mapping = NULL, .mapping_size = 0,
+                       .compiled = false, .configured_tickets = safe_malloc(MAX_EVENTS * sizeof(uint16_t)) };
+}
+
+static void free_catalog_arrays(Catalog *catalog) {
+    free(catalog->tickets);
+    free(catalog->ticket_count_offsets);
+    free(catalog->page_ticket_count_offsets);
+    free(catalog->description_offsets);
+    free(catalog->description_lengths);
+}
+
+// Drops a catalog that failed to load, the mapping stays with the caller.
+static bool reject_catalog(Catalog *catalog, const char **error, const char *message) {
+    free_catalog_arrays(catalog);
+    free(catalog->configured_tickets);
+    *error = message;
+    return false;
+}
+
+// Parses the events file in a single pass without copying the descriptions. Returns false with the reason in
+// `error` when the file is malformed.
+bool parse_events(const char *text, size_t size, Catalog *result, const char **error) {
+    Catalog catalog = allocate_catalog();
+    size_t count = 0;
+    const char *end = text + size;
+    const char *line = text;
+
+    while (line < end) {
+        const char *description_end = memchr(line, '\n', (size_t) (end - line));
+        if (description_end == NULL || description_end + 1 >= end) {
+            break;
+        }
+        if (count == MAX_EVENTS) {
+            fprintf(stderr, "Only the first %d events of the catalog are used.\n", MAX_EVENTS);
+            break;
+        }
+
+        // Only digits, a count that does not fit the ticket counter or a stray '\r' is an error.
+        const char *digit = description_end + 1;
+        uint32_t tickets = 0;
+        for (; digit < end && *digit != '\n'; digit++) {
+            if (*digit < '0' || *digit > '9') {
+                return reject_catalog(&catalog, error, "events file has an invalid ticket count.");
+            }
+            tickets = tickets * 10 + (uint32_t) (*digit - '0');
+            if (tickets > UINT16_MAX) {
+                return reject_catalog(&catalog, error, "events file has an invalid ticket count.");
+            }
+        }
+        if (digit == description_end + 1) {
+            return reject_catalog(&catalog, error, "events file has an invalid ticket count.");
+        }
+
+        catalog.configured_tickets[count] = (uint16_t) tickets;
+        atomic_init(&catalog.tickets[count], (uint16_t) tickets);
+        catalog.description_offsets[count] = (uint32_t) (line - text);
+        catalog.description_lengths[count] = (uint8_t) (description_end - line);
+        count++;
+        line = digit + 1;
+    }
+
+    catalog.count = count;
+    catalog.descriptions = text;
+    *result = catalog;
+    return true;
+}
+
+// Whether the page table and the positions of the events stay within the parts of the file they point into,
+// so that neither sending the pages nor patching the ticket counts can reach past the mapping. Every event
+// must lie within the page the page table assigns it to, a reply starting at it is cut from that page.
+static bool valid_catalog_positions(const Catalog *catalog, size_t count, const CatalogHeader *header,
+                                    const char *mapping) {
+    const char *page_table = mapping + header->page_table_offset;
+    EventsPage page;
+    memcpy(&page, page_table, sizeof(page));
+    if (page.first_event_id != 0 || page.offset != 0) {
+        return false;
+    }
+    for (size_t index = 1; index <= header->page_count; index++) {
+        EventsPage next;
+        memcpy(&next, page_table + index * sizeof(EventsPage), sizeof(next));
+        if (next.first_event_id < page.first_event_id || next.first_event_id > count || next.offset < page.offset
+            || next.offset - page.offset > MAX_MESSAGE_LENGTH || next.offset - page.offset < EVENTS_PAGE_HEADER_SIZE
+            || next.offset > header->pages_length) {
+            return false;
+        }
+
+        // The description follows the ticket count, so it is enough that it ends within the page.
+        for (size_t i = page.first_event_id; i < next.first_event_id; i++) {
+            uint64_t ticket_count_offset = catalog->page_ticket_count_offsets[i];
+            uint64_t description_end = (uint64_t) catalog->description_offsets[i] + catalog->description_lengths[i];
+            if (ticket_count_offset < (uint64_t) page.offset + EVENTS_PAGE_HEADER_SIZE
+                                      + EVENT_ENTRY_TICKET_COUNT_OFFSET
+                || catalog->description_offsets[i] < ticket_count_offset || description_end > next.offset) {
+                return false;
+            }
+        }
+        page = next;
+    }
+    if (page.first_event_id != count || page.offset != header->pages_length) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t offset = catalog->ticket_count_offsets[i];
+        if ((offset == 0) != (i >= header->events_message_event_count)
+            || (offset != 0 && offset + sizeof(uint16_t) > header->events_message_length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool map_compiled_catalog(char *mapping, size_t size, Catalog *result, const char **error) {
+    CatalogHeader header;
+    memcpy(&header, mapping, sizeof(header));
+
+    if (header.version != CATALOG_VERSION || header.event_count > MAX_EVENTS
+        || header.events_offset % _Alignof(uint32_t) != 0 || header.events_offset > size
+        || catalog_arrays_size(header.event_count) > size - header.events_offset
+        || header.page_table_offset % _Alignof(EventsPage) != 0 || header.page_table_offset > size
+        || header.page_count >= (size - header.page_table_offset) / sizeof(EventsPage)
+        || header.events_message_offset > size || header.events_message_length > size - header.events_message_offset
+        || header.events_message_length > MAX_MESSAGE_LENGTH || header.events_message_event_count > header.event_count
+        || header.pages_offset > size || header.pages_length > size - header.pages_offset) {
+        *error = "compiled catalog is corrupted.";
+        return false;
+    }
+
+    // The arrays are copied out of the file, a reload may append to them.
+    Catalog catalog = allocate_catalog();
+    size_t count = header.event_count;
+    const char *array = mapping + header.events_offset;
+    memcpy(catalog.ticket_count_offsets, array, count * sizeof(uint32_t));
+    array += count * sizeof(uint32_t);
+    memcpy(catalog.page_ticket_count_offsets, array, count * sizeof(uint32_t));
+    array += count * sizeof(uint32_t);
+    memcpy(catalog.configured_tickets, array, count * sizeof(uint16_t));
+    array += count * sizeof(uint16_t);
+    memcpy(catalog.description_lengths, array, count * sizeof(uint8_t));
+    for (size_t i = 0; i < count; i++) {
+        atomic_init(&catalog.tickets[i], catalog.configured_tickets[i]);
+        catalog.description_offsets[i] = catalog.page_ticket_count_offsets[i] + EVENT_ENTRY_DESCRIPTION_DISTANCE;
+    }
+    if (!valid_catalog_positions(&catalog, count, &header, mapping)) {
+        return reject_catalog(&catalog, error, "compiled catalog is corrupted.");
+    }
+
+    catalog.count = count;
+    catalog.descriptions = mapping + header.pages_offset;
+    catalog.mapping = mapping;
+    catalog.mapping_size = size;
+    catalog.compiled = true;
+    *result = catalog;
+    return true;
+}
+
+// Maps the events file, it is either the text format or a catalog compiled with `compile_catalog`. Returns
+// false with the reason in `error` when the file is malformed, a reload then keeps the current catalog.
+bool load_catalog(FILE *file_ptr, Catalog *catalog, const char **error) {
+    int fd = fileno(file_ptr);
+    struct stat file_stat;
+    CHECK_ERRNO(fstat(fd, &file_stat));
+    size_t size = (size_t) file_stat.st_size;
+
+    bool loaded;
+    if (size == 0) {
+        loaded = parse_events("", 0, catalog, error);
+    }
+    else {
+        // Private and writable, so the ticket counts of a compiled catalog can change in place.
+        char *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ENSURE(mapping != MAP_FAILED);
+
+        uint64_t magic = 0;
+        memcpy(&magic, mapping, size < sizeof(magic) ? size : sizeof(magic));
+        if (magic == CATALOG_MAGIC && size >= sizeof(CatalogHeader)) {
+            loaded = map_compiled_catalog(mapping, size, catalog, error);
+        }
+        else {
+            loaded = parse_events(mapping, size, catalog, error);
+            catalog->mapping = mapping;
+            catalog->mapping_size = size;
+        }
+        if (!loaded) {
+            CHECK_ERRNO(munmap(mapping, size));
+        }
+    }
+
+    fclose(file_ptr);
+    return loaded;
+}
+
+// At startup there is no catalog to fall back to.
+Catalog load_catalog_or_exit(FILE *file_ptr) {
+    Catalog catalog;
+    const char *error;
+    if (!load_catalog(file_ptr, &catalog, &error)) {
+        fatal(error);
+    }
+    return catalog;
+}
+
+// Encodes the event at `index` of a reply, returns the index after it.
+static size_t write_event(char *message, size_t index, const Catalog *catalog, uint32_t event_id,
+                          const char *description) {
+    EventEntry entry = { .event_id = event_id, .ticket_count = available_tickets(catalog, event_id),
+                         .description_length = catalog->description_lengths[event_id] };
+    encode_event_entry(message + index, &entry);
+
+    memcpy(message + index + EVENT_ENTRY_SIZE, description, entry.description_length);
+    return index + EVENT_ENTRY_SIZE + entry.description_length;
+}
+
+static void write_next_page_id(EventsMessage *events_message, size_t page) {
+    EventsPageMessage header = { .next_event_id = page + 1 < events_message->page_count
+                                                  ? events_message->page_table[page + 1].first_event_id
+                                                  : NO_MORE_EVENTS };
+    encode_events_page(events_message->pages + events_message->page_table[page].offset, &header);
+}
+
+// Encodes events `first` to `count` after the events already in `previous`, into the EVENTS message while it
+// has room and into the pages, continuing the last page of `previous`. Descriptions are taken relative to
+// `descriptions`.
+static EventsMessage *extend_events_message(const EventsMessage *previous, Catalog *catalog, size_t first,
+                                            size_t count, const char *descriptions) {
+    size_t length = previous->length;
+    size_t message_event_count = previous->event_count;
+    size_t pages_length = previous->page_table[previous->page_count].offset;
+    size_t page_count = previous->page_count;
+    size_t page_length = page_count == 0 ? 0 : pages_length - previous->page_table[page_count - 1].offset;
+
+    for (size_t i = first; i < count; i++) {
+        size_t size = event_message_size(catalog, i);
+        if (message_event_count == i && length + size <= MAX_MESSAGE_LENGTH) {
+            length += size;
+            message_event_count++;
+        }
+        if (page_count == 0 || page_length + size > MAX_MESSAGE_LENGTH) {
+            page_count++;
+            page_length = EVENTS_PAGE_HEADER_SIZE;
+            pages_length += EVENTS_PAGE_HEADER_SIZE;
+        }
+        page_length += size;
+        pages_length += size;
+    }
+    if (pages_length > UINT32_MAX) {
+        fatal("the catalog is too large.");
+    }
+
+    EventsMessage *events_message = safe_malloc(sizeof(EventsMessage));
+    *events_message = (EventsMessage) { .message = safe_malloc(length), .length = length,
+                                        .event_count = message_event_count, .pages = safe_malloc(pages_length),
+                                        .page_table = safe_malloc((page_count + 1) * sizeof(EventsPage)),
+                                        .page_count = page_count, .mapped = false };
+    memcpy(events_message->message, previous->message, previous->length);
+    memcpy(events_message->pages, previous->pages, previous->page_table[previous->page_count].offset);
+    memcpy(events_message->page_table, previous->page_table, previous->page_count * sizeof(EventsPage));
+
+    size_t index = previous->length;
+    size_t page_index = previous->page_table[previous->page_count].offset;
+    page_count = previous->page_count;
+    for (size_t i = first; i < count; i++) {
+        const char *description = descriptions + catalog->description_offsets[i];
+        size_t size = event_message_size(catalog, i);
+
+        catalog->ticket_count_offsets[i] = 0;
+        if (i < message_event_count) {
+            catalog->ticket_count_offsets[i] = index + EVENT_ENTRY_TICKET_COUNT_OFFSET;
+            index = write_event(events_message->message, index, catalog, i, description);
+        }
+        if (page_count == 0 || page_index + size - events_message->page_table[page_count - 1].offset
+                               > MAX_MESSAGE_LENGTH) {
+            events_message->page_table[page_count++] = (EventsPage) { .first_event_id = i, .offset = page_index };
+            page_index += EVENTS_PAGE_HEADER_SIZE;
+        }
+        catalog->page_ticket_count_offsets[i] = page_index + EVENT_ENTRY_TICKET_COUNT_OFFSET;
+        page_index = write_event(events_message->pages, page_index, catalog, i, description);
+    }
+    events_message->page_table[page_count] = (EventsPage) { .first_event_id = count, .offset = page_index };
+
+    // The last page of `previous` may be followed by new ones now.
+    for (size_t page = previous->page_count == 0 ? 0 : previous->page_count - 1; page < page_count; page++) {
+        write_next_page_id(events_message, page);
+    }
+    return events_message;
+}
+
+EventsMessage *build_events_message(Catalog *catalog) {
+    if (catalog->compiled) {
+        CatalogHeader header;
+        memcpy(&header, catalog->mapping, sizeof(header));
+        EventsMessage *events_message = safe_malloc(sizeof(EventsMessage));
+        *events_message = (EventsMessage) { .message = catalog->mapping + header.events_message_offset,
+                                            .length = header.events_message_length,
+                                            .event_count = header.events_message_event_count,
+                                            .pages = catalog->mapping + header.pages_offset,
+                                            .page_table = (EventsPage *) (catalog->mapping + header.page_table_offset),
+                                            .page_count = header.page_count, .mapped = true };
+        return events_message;
+    }
+
+    char events_type = EVENTS;
+    EventsPage no_pages = { .first_event_id = 0, .offset = 0 };
+    EventsMessage empty = { .message = &events_type, .length = 1, .event_count = 0, .pages = &events_type,
+                            .page_table = &no_pages, .page_count = 0, .mapped = false };
+    return extend_events_message(&empty, catalog, 0, catalog->count, catalog->descriptions);
+}
+
+static void write_catalog_part(FILE *file_ptr, const void *data, size_t size) {
+    if (fwrite(data, 1, size, file_ptr) != size) {
+        fatal("writing of the compiled catalog failed.");
+    }
+}
+
+// Writes the catalog in the format mapped by `load_catalog`, descriptions are taken from the pages.
+// The file is replaced by a rename, a server that has the previous one mapped keeps seeing its contents.
+void compile_catalog(Catalog *catalog, EventsMessage *events_message, const char *path) {
+    char temporary_path[PATH_MAX];
+    int path_length = snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+    if (path_length < 0 || path_length >= PATH_MAX) {
+        fatal("compiled catalog path is too long.");
+    }
+    FILE *file_ptr = fopen(temporary_path, "w");
+    if (!file_ptr) {
+        fatal("opening of the compiled catalog failed.");
+    }
+
+    // The page table follows the arrays at an aligned position.
+    size_t events_size = catalog_arrays_size(catalog->count);
+    size_t padding = (_Alignof(EventsPage) - (CATALOG_EVENTS_OFFSET + events_size) % _Alignof(EventsPage))
+                     % _Alignof(EventsPage);
+    events_size += padding;
+    size_t page_table_size = (events_message->page_count + 1) * sizeof(EventsPage);
+    size_t pages_length = events_message->page_table[events_message->page_count].offset;
+    CatalogHeader header = { .magic = CATALOG_MAGIC, .version = CATALOG_VERSION, .reserved = 0,
+                             .event_count = catalog->count, .events_offset = CATALOG_EVENTS_OFFSET,
+                             .page_table_offset = CATALOG_EVENTS_OFFSET + events_size,
+                             .page_count = events_message->page_count,
+                             .events_message_offset = CATALOG_EVENTS_OFFSET + events_size + page_table_size,
+                             .events_message_length = events_message->length,
+                             .events_message_event_count = events_message->event_count,
+                             .pages_offset = CATALOG_EVENTS_OFFSET + events_size + page_table_size
+                                             + events_message->length,
+                             .pages_length = pages_length };
+    char header_block[CATALOG_EVENTS_OFFSET] = { 0 };
+    memcpy(header_block, &header, sizeof(header));
+    write_catalog_part(file_ptr, header_block, sizeof(header_block));
+
+    // Configured counts are the current ones, descriptions are found from the page offsets.
+    write_catalog_part(file_ptr, catalog->ticket_count_offsets, catalog->count * sizeof(uint32_t));
+    write_catalog_part(file_ptr, catalog->page_ticket_count_offsets, catalog->count * sizeof(uint32_t));
+    for (size_t i = 0; i < catalog->count; i++) {
+        uint16_t tickets = available_tickets(catalog, i);
+        write_catalog_part(file_ptr, &tickets, sizeof(tickets));
+    }
+    write_catalog_part(file_ptr, catalog->description_lengths, catalog->count * sizeof(uint8_t));
+    char zeros[_Alignof(EventsPage)] = { 0 };
+    write_catalog_part(file_ptr, zeros, padding);
+    write_catalog_part(file_ptr, events_message->page_table, page_table_size);
+    write_catalog_part(file_ptr, events_message->message, events_message->length);
+    write_catalog_part(file_ptr, events_message->pages, pages_length);
+
+    if (fclose(file_ptr) != 0 || rename(temporary_path, path) != 0) {
+        fatal("writing of the compiled catalog failed.");
+    }
+}
+
+// Moves the count by `delta`, unless more tickets are taken than the new configured count allows. The count
+// never exceeds the configured one, so a raise always fits.
+static bool adjust_tickets(Catalog *catalog, size_t event_id, int32_t delta) {
+    uint16_t tickets = available_tickets(catalog, event_id);
+    do {
+        if ((int32_t) tickets + delta < 0) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&catalog->tickets[event_id], &tickets,
+                                                    (uint16_t) ((int32_t) tickets + delta), memory_order_relaxed,
+                                                    memory_order_relaxed));
+    return true;
+}
+
+static int32_t configured_change(const Catalog *catalog, const Catalog *next, size_t event_id) {
+    return (int32_t) next->configured_tickets[event_id] - (int32_t) catalog->configured_tickets[event_id];
+}
+
+// Moves the shared counts of the events of `catalog` by the change of their configured counts in `next`. A
+// count lowered below the tickets that reservations hold or that were issued would let the tickets returned
+// by expirations be sold again, so the reload is refused and the counts already moved are restored.
+bool adjust_ticket_counts(Catalog *catalog, const Catalog *next, char *status, size_t status_size) {
+    for (size_t i = 0; i < catalog->count; i++) {
+        if (adjust_tickets(catalog, i, configured_change(catalog, next, i))) {
+            continue;
+        }
+        snprintf(status, status_size, "reload failed: event %zu has more tickets taken than its new count.\n", i);
+        while (i-- > 0) {
+            adjust_tickets(catalog, i, -configured_change(catalog, next, i));
+        }
+        return false;
+    }
+    return true;
+}
+
+static void write_ticket_count(char *field, const Catalog *catalog, size_t event_id) {
+    write_uint16_t(field, available_tickets(catalog, event_id));
+}
+
+// Applies a reloaded catalog, whose first events are those of `catalog`, to the events the workers share.
+// The counts were already moved by `adjust_ticket_counts`, so tickets held by reservations stay taken, and new
+// events are appended. The EVENTS message and the pages are extended from the current ones instead of
+// encoded from scratch. Afterwards `next` describes the merged catalog, its descriptions are those in the
+// returned pages.
+EventsMessage *merge_catalog(Catalog *catalog, const EventsMessage *events_message, Catalog *next) {
+    // The new events are not visible to the workers before the merged catalog is published.
+    for (size_t i = catalog->count; i < next->count; i++) {
+        atomic_init(&catalog->tickets[i], available_tickets(next, i));
+        catalog->description_offsets[i] = next->description_offsets[i];
+        catalog->description_lengths[i] = next->description_lengths[i];
+    }
+    EventsMessage *merged_message = extend_events_message(events_message, catalog, catalog->count,
+                                                          next->count, next->descriptions);
+
+    for (size_t i = 0; i < catalog->count; i++) {
+        if (configured_change(catalog, next, i) != 0) {
+            if (catalog->ticket_count_offsets[i] != 0) {
+                write_ticket_count(merged_message->message + catalog->ticket_count_offsets[i], catalog, i);
+            }
+            write_ticket_count(merged_message->pages + catalog->page_ticket_count_offsets[i], catalog, i);
+        }
+    }
+    for (size_t i = 0; i < next->count; i++) {
+        catalog->description_offsets[i] = catalog->page_ticket_count_offsets[i] + EVENT_ENTRY_DESCRIPTION_DISTANCE;
+    }
+
+    free_catalog_arrays(next);
+    if (next->mapping != NULL) {
+        CHECK_ERRNO(munmap(next->mapping, next->mapping_size));
+    }
+    next->tickets = catalog->tickets;
+    next->ticket_count_offsets = catalog->ticket_count_offsets;
+    next->page_ticket_count_offsets = catalog->page_ticket_count_offsets;
+    next->description_offsets = catalog->description_offsets;
+    next->description_lengths = catalog->description_lengths;
+    next->descriptions = merged_message->pages;
+    next->mapping = NULL;
+    next->mapping_size = 0;
+    next->compiled = false;
+    return merged_message;
+}
+
+uint64_t count_available_tickets(const Catalog *catalog) {
+    uint64_t tickets = 0;
+    for (size_t i = 0; i < catalog->count; i++) {
+        tickets += available_tickets(catalog, i);
+    }
+    return tickets;
+}
+
+void destroy_events_message(EventsMessage *events_message) {
+    if (!events_message->mapped) {
+        free(events_message->message);
+        free(events_message->pages);
+        free(events_message->page_table);
+    }
+    free(events_message);
+}
+
+void destroy_catalog(Catalog *catalog) {
+    free_catalog_arrays(catalog);
+    free(catalog->configured_tickets);
+    if (catalog->mapping != NULL) {
+        CHECK_ERRNO(munmap(catalog->mapping, catalog->mapping_size));
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef _CATALOG_
+#define _CATALOG_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "protocol.h"
+
+// "TICKCAT1" read as a little endian integer.
+#define CATALOG_MAGIC 0x315441434b434954ULL
+#define CATALOG_VERSION 3
+
+// Page of the paged extension, a page holds consecutive events.
+typedef struct EventsPage {
+    uint32_t first_event_id;
+    // Position of the page's reply in the pages.
+    uint32_t offset;
+} EventsPage;
+
+// EVENTS message and EVENTS_PAGE replies encoded once at startup, only the ticket counts are patched
+// afterwards.
+typedef struct EventsMessage {
+    char *message;
+    size_t length;
+    // The first events of the catalog, as many as fit in a datagram. All of them are in the pages.
+    size_t event_count;
+    // Complete EVENTS_PAGE replies one after another. The page table has an entry for every page and one
+    // more holding the number of events and the length of all pages.
+    char *pages;
+    EventsPage *page_table;
+    size_t page_count;
+    // Part of a mapped compiled catalog instead of allocations of its own.
+    bool mapped;
+} EventsMessage;
+
+// Events of the server, as arrays indexed by the event id. Descriptions are not copied, they stay in the
+// mapped file. The EVENTS message of a compiled catalog is used in place, the kernel copies only the pages
+// whose ticket counts change.
+typedef struct Catalog {
+    // The arrays have room for the largest catalog, so events added by a reload never move the ones the
+    // workers use. Only the part in use is ever touched.
+    // Tickets left, shared by all workers. Apart from the rest, so that reservations and scans of the counts
+    // touch as few cache lines as possible.
+    _Atomic uint16_t *tickets;
+    // Positions of the event's ticket_count field in the EVENTS message, 0 when the event does not fit in it,
+    // and in the EVENTS_PAGE replies.
+    uint32_t *ticket_count_offsets;
+    uint32_t *page_ticket_count_offsets;
+    // Positions of the descriptions relative to `descriptions`.
+    uint32_t *description_offsets;
+    uint8_t *description_lengths;
+    size_t count;
+    const char *descriptions;
+    char *mapping;
+    size_t mapping_size;
+    bool compiled;
+    // Ticket counts in the events file, before any reservation.
+    uint16_t *configured_tickets;
+} Catalog;
+
+// Header of a compiled catalog, followed by the arrays of the events, the page table, the EVENTS message and
+// the pages. The descriptions of the events are those in the pages. Integers are in the byte order of the
+// machine that compiled it.
+typedef struct CatalogHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t event_count;
+    uint64_t events_offset;
+    uint64_t page_table_offset;
+    uint64_t page_count;
+    uint64_t events_message_offset;
+    uint64_t events_message_length;
+    uint64_t events_message_event_count;
+    uint64_t pages_offset;
+    uint64_t pages_length;
+} CatalogHeader;
+
+static inline uint16_t available_tickets(const Catalog *catalog, size_t event_id) {
+    return atomic_load_explicit(&catalog->tickets[event_id], memory_order_relaxed);
+}
+
+static inline size_t event_message_size(const Catalog *catalog, size_t event_id) {
+    return EVENT_ENTRY_SIZE + catalog->description_lengths[event_id];
+}
+
+static inline const char *event_description(const Catalog *catalog, size_t event_id) {
+    return catalog->descriptions + catalog->description_offsets[event_id];
+}
+
+bool parse_events(const char *text, size_t size, Catalog *result, const char **error);
+bool load_catalog(FILE *file_ptr, Catalog *catalog, const char **error);
+Catalog load_catalog_or_exit(FILE *file_ptr);
+EventsMessage *build_events_message(Catalog *catalog);
+void compile_catalog(Catalog *catalog, EventsMessage *events_message, const char *path);
+bool adjust_ticket_counts(Catalog *catalog, const Catalog *next, char *status, size_t status_size);
+EventsMessage *merge_catalog(Catalog *catalog, const EventsMessage *events_message, Catalog *next);
+uint64_t count_available_tickets(const Catalog *catalog);
+void destroy_events_message(EventsMessage *events_message);
+void destroy_catalog(Catalog *catalog);
+
+#endif // _CATALOG_
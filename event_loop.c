@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "event_loop.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "reload.h"
+
+EventLoop new_event_loop(bool busy_poll, _Atomic uint64_t *syscalls) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ENSURE(epoll_fd >= 0);
+    return (EventLoop) { .epoll_fd = epoll_fd, .count = 0, .busy_poll = busy_poll, .syscalls = syscalls };
+}
+
+void watch_descriptor(EventLoop *loop, int fd, EventHandler handler, void *context) {
+    ENSURE(loop->count < MAX_EVENT_SOURCES);
+    struct epoll_event event = { .events = EPOLLIN, .data.u64 = loop->count };
+    CHECK_ERRNO(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event));
+    loop->sources[loop->count++] = (EventSource) { .fd = fd, .handler = handler, .context = context };
+}
+
+// Runs the handlers of the descriptors that are ready, in the order they were added, so a worker handles
+// the datagrams that arrived before the timer fired first.
+void wait_for_events(EventLoop *loop) {
+    struct epoll_event events[MAX_EVENT_SOURCES];
+    int ready;
+    do {
+        errno = 0;
+        ready = epoll_wait(loop->epoll_fd, events, MAX_EVENT_SOURCES, loop->busy_poll ? 0 : -1);
+        if (loop->syscalls != NULL) {
+            metric_add(loop->syscalls, 1);
+        }
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0) {
+        PRINT_ERRNO();
+    }
+
+    bool is_ready[MAX_EVENT_SOURCES] = { false };
+    for (int i = 0; i < ready; i++) {
+        is_ready[events[i].data.u64] = true;
+    }
+    for (size_t i = 0; i < loop->count; i++) {
+        if (is_ready[i]) {
+            loop->sources[i].handler(loop->sources[i].context, loop->sources[i].fd);
+        }
+    }
+}
+
+_Noreturn void run_event_loop(EventLoop *loop) {
+    while (true) {
+        wait_for_events(loop);
+    }
+}
+
+int new_periodic_timer(uint64_t interval_ns) {
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    ENSURE(timer_fd >= 0);
+    struct timespec interval = { .tv_sec = (time_t) (interval_ns / 1000000000),
+                                 .tv_nsec = (long) (interval_ns % 1000000000) };
+    struct itimerspec schedule = { .it_interval = interval, .it_value = interval };
+    CHECK_ERRNO(timerfd_settime(timer_fd, 0, &schedule, NULL));
+    return timer_fd;
+}
+
+// Returns the number of periods since the previous read.
+uint64_t read_timer(int timer_fd) {
+    uint64_t expirations = 0;
+    errno = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN && errno != EINTR) {
+        PRINT_ERRNO();
+    }
+    return expirations;
+}
+
+// The signal must already be blocked in every thread, so that it is only ever read from the descriptor.
+int new_signal_descriptor(int signal_number) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, signal_number);
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    ENSURE(signal_fd >= 0);
+    return signal_fd;
+}
+
+// Work of a worker that must not wait for the next datagram: reservations expire on time even when no
+// request comes, so their tickets are back on sale and the first request after a lull does not pay for the
+// whole backlog. Called between batches, when no queued reply refers to the EVENTS message.
+void run_housekeeping(Server *server) {
+    server->time_when_received = time(NULL);
+    server->time_ns_when_received = monotonic_ns();
+    check_outdated_reservations(server, ALL_EXPIRATIONS);
+    // Expirations are journaled like those found by a request.
+    commit_journal(server);
+    if (server->reloader != NULL) {
+        adopt_latest_catalog(server);
+    }
+    if (server->journal != NULL && server->parameters.snapshot_interval > 0) {
+        take_snapshot(server);
+    }
+    log_record(LOG_HOUSEKEEPING, server->worker_id, metric_read(&server->metrics.reservations_pending));
+}
+
+// Lets receives on the socket poll the device queue for up to `busy_poll_us` instead of waiting for an
+// interrupt. Raising it above net.core.busy_read needs CAP_NET_ADMIN, without it the socket is left as it is.
+void enable_busy_poll(int socket_fd, long busy_poll_us) {
+    int value = (int) busy_poll_us;
+    int prefer = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0
+        || setsockopt(socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0) {
+        fprintf(stderr, "Busy polling of the socket is not permitted: %s\n", strerror(errno));
+    }
+}
+
+void pin_to_cpu(size_t cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    CHECK(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus));
+}
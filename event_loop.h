@@ -0,0 +1,44 @@
+#ifndef _EVENT_LOOP_
+#define _EVENT_LOOP_
+
+#include "server.h"
+
+// A worker watches its socket and its housekeeping timer, the control thread the admin socket and SIGHUP.
+#define MAX_EVENT_SOURCES 4
+// Period of the housekeeping of the workers, the resolution of the timer wheel.
+#define HOUSEKEEPING_INTERVAL_NS 1000000000ULL
+
+// Called when `fd` is readable. Level triggered, so whatever the handler leaves unread is reported again.
+typedef void (*EventHandler)(void *context, int fd);
+
+typedef struct EventSource {
+    int fd;
+    EventHandler handler;
+    void *context;
+} EventSource;
+
+// epoll instance of one thread. With `busy_poll` it never sleeps in the kernel, the thread spins on the
+// ready list and keeps its core, which only pays off on a host dedicated to the server.
+typedef struct EventLoop {
+    int epoll_fd;
+    EventSource sources[MAX_EVENT_SOURCES];
+    size_t count;
+    bool busy_poll;
+    // Counts the waits, NULL when they are not counted.
+    _Atomic uint64_t *syscalls;
+} EventLoop;
+
+EventLoop new_event_loop(bool busy_poll, _Atomic uint64_t *syscalls);
+void watch_descriptor(EventLoop *loop, int fd, EventHandler handler, void *context);
+void wait_for_events(EventLoop *loop);
+_Noreturn void run_event_loop(EventLoop *loop);
+
+int new_periodic_timer(uint64_t interval_ns);
+uint64_t read_timer(int timer_fd);
+int new_signal_descriptor(int signal_number);
+
+void run_housekeeping(Server *server);
+void enable_busy_poll(int socket_fd, long busy_poll_us);
+void pin_to_cpu(size_t cpu);
+
+#endif // _EVENT_LOOP_
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+static void journal_path(char *path, const char *directory, size_t worker_id) {
+    int length = snprintf(path, PATH_MAX, "%s/journal.%zu", directory, worker_id);
+    if (length < 0 || length >= PATH_MAX) {
+        fatal("journal path is too long.");
+    }
+}
+
+// FNV-1a of the record without its checksum.
+static uint32_t record_checksum(const JournalRecord *record) {
+    const unsigned char *bytes = (const unsigned char *) record;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < offsetof(JournalRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Returns false when the worker has no journal yet.
+bool read_journal_header(const char *directory, size_t worker_id, JournalHeader *header) {
+    char path[PATH_MAX];
+    journal_path(path, directory, worker_id);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return false;
+        }
+        PRINT_ERRNO();
+    }
+    ssize_t read_length = read(fd, header, sizeof(JournalHeader));
+    CHECK_ERRNO(close(fd));
+    if (read_length == 0) {
+        return false;
+    }
+    if (read_length != sizeof(JournalHeader) || header->magic != JOURNAL_MAGIC
+        || header->version != JOURNAL_VERSION || header->worker_id != worker_id) {
+        fatal("journal is corrupted.");
+    }
+    return true;
+}
+
+// Opens the journal of the worker named in the header, creating it when it does not exist. An existing
+// journal must have been written for the same number of workers and at most as many events.
+Journal *open_journal(const char *directory, const JournalHeader *header) {
+    char path[PATH_MAX];
+    journal_path(path, directory, header->worker_id);
+
+    JournalHeader existing_header;
+    bool exists = read_journal_header(directory, header->worker_id, &existing_header);
+    // Reloads only append events, so the catalog may have grown since.
+    if (exists && (existing_header.workers != header->workers
+                   || existing_header.event_count > header->event_count)) {
+        fatal("journal was written for a different number of workers or for more events.");
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        PRINT_ERRNO();
+    }
+    if (!exists) {
+        CHECK_ERRNO(ftruncate(fd, 0));
+        ENSURE(write(fd, header, sizeof(JournalHeader)) == sizeof(JournalHeader));
+        CHECK_ERRNO(fdatasync(fd));
+
+        // The new directory entry has to be durable as well.
+        int directory_fd = open(directory, O_RDONLY | O_DIRECTORY);
+        if (directory_fd < 0) {
+            PRINT_ERRNO();
+        }
+        CHECK_ERRNO(fsync(directory_fd));
+        CHECK_ERRNO(close(directory_fd));
+    }
+
+    struct stat file_stat;
+    CHECK_ERRNO(fstat(fd, &file_stat));
+
+    Journal *journal = safe_malloc(sizeof(Journal));
+    *journal = (Journal) { .fd = fd, .buffer = safe_malloc(JOURNAL_INITIAL_CAPACITY), .length = 0,
+                           .capacity = JOURNAL_INITIAL_CAPACITY, .size = (uint64_t) file_stat.st_size };
+    return journal;
+}
+
+void destroy_journal(Journal *journal) {
+    CHECK_ERRNO(close(journal->fd));
+    free(journal->buffer);
+    free(journal);
+}
+
+void append_journal_record(Journal *journal, JournalRecord record) {
+    if (journal->length + sizeof(record) > journal->capacity) {
+        journal->capacity *= 2;
+        journal->buffer = safe_realloc(journal->buffer, journal->capacity);
+    }
+    record.checksum = record_checksum(&record);
+    memcpy(journal->buffer + journal->length, &record, sizeof(record));
+    journal->length += sizeof(record);
+}
+
+// Group commit, one write and one fdatasync make all records of the batch durable.
+void commit_journal(Server *server) {
+    Journal *journal = server->journal;
+    if (journal == NULL || journal->length == 0) {
+        return;
+    }
+
+    size_t written = 0;
+    while (written < journal->length) {
+        errno = 0;
+        ssize_t result = write(journal->fd, journal->buffer + written, journal->length - written);
+        if (result < 0 && errno != EINTR) {
+            PRINT_ERRNO();
+        }
+        written += result > 0 ? (size_t) result : 0;
+    }
+    CHECK_ERRNO(fdatasync(journal->fd));
+
+    metric_add(&server->metrics.syscalls, 2);
+    metric_add(&server->metrics.journal_commits, 1);
+    metric_add(&server->metrics.journal_bytes, journal->length);
+    journal->size += journal->length;
+    journal->length = 0;
+}
+
+// Whether an intact record refers to something this worker could have written.
+static bool valid_record(Server *server, const JournalRecord *record) {
+    ReservationsContainer *reservations = &server->reservations;
+    uint32_t reservation_id = record->reservation_id;
+
+    if (record->type == JOURNAL_RESERVE) {
+        return reservation_id >= reservations->first_id
+               && (reservation_id - reservations->first_id) % reservations->id_step == 0
+               && record->event_id < server->catalog.count && record->ticket_count > 0;
+    }
+    return record->type == JOURNAL_ISSUE || record->type == JOURNAL_EXPIRE;
+}
+
+static void apply_record(Server *server, const JournalRecord *record) {
+    ReservationsContainer *reservations = &server->reservations;
+
+    if (record->type == JOURNAL_RESERVE) {
+        Reservation *reservation = insert_reservation_with_id(reservations, record->reservation_id);
+        reservation->event_id = record->event_id;
+        reservation->ticket_count = record->ticket_count;
+        reservation->expiration_time = record->value;
+        reservation->first_ticket_id = NO_TICKETS;
+        add_timer(reservations, reservation);
+        // Other workers replay their returns separately, so the count may pass through negative values.
+        atomic_fetch_sub_explicit(&server->catalog.tickets[record->event_id], record->ticket_count,
+                                  memory_order_relaxed);
+        metric_add(&server->metrics.reservations_pending, 1);
+        metric_add(&server->metrics.tickets_held, record->ticket_count);
+        return;
+    }
+
+    Reservation *reservation = get_reservation(reservations, record->reservation_id);
+    if (reservation == NULL || reservation->first_ticket_id != NO_TICKETS) {
+        fatal("journal is corrupted.");
+    }
+    metric_sub(&server->metrics.reservations_pending, 1);
+    metric_sub(&server->metrics.tickets_held, reservation->ticket_count);
+
+    if (record->type == JOURNAL_ISSUE) {
+        cancel_timer(reservations, reservation);
+        reservation->first_ticket_id = (int64_t) record->value;
+        server->next_ticket_id = reservation->first_ticket_id + reservation->ticket_count;
+        metric_add(&server->metrics.tickets_issued, reservation->ticket_count);
+    }
+    else {
+        cancel_timer(reservations, reservation);
+        return_tickets(&server->catalog, reservation->event_id, reservation->ticket_count);
+        remove_reservation(reservations, reservation);
+    }
+}
+
+// Rebuilds the reservations, the ticket counter and this worker's share of the event ticket counts from the
+// records after `offset`, the state before it is already in place. A torn record at the end is cut off, it
+// was never committed, so no reply depends on it.
+void replay_journal(Server *server, uint64_t offset) {
+    Journal *journal = server->journal;
+    size_t size = (size_t) journal->size;
+    if (offset > size) {
+        fatal("journal is shorter than its snapshot.");
+    }
+    if (size == offset) {
+        return;
+    }
+
+    // Only the part after the offset is mapped, the mapping has to start at a page boundary.
+    size_t mapping_offset = offset & ~((size_t) sysconf(_SC_PAGESIZE) - 1);
+    char *mapping = mmap(NULL, size - mapping_offset, PROT_READ, MAP_PRIVATE, journal->fd, (off_t) mapping_offset);
+    ENSURE(mapping != MAP_FAILED);
+    mapping -= mapping_offset;
+    size_t end = offset;
+    uint64_t first_expiration_time = UINT64_MAX;
+    JournalRecord record;
+
+    for (; end + sizeof(record) <= size; end += sizeof(record)) {
+        memcpy(&record, mapping + end, sizeof(record));
+        if (record.checksum != record_checksum(&record)) {
+            break;
+        }
+        if (!valid_record(server, &record)) {
+            fatal("journal is corrupted.");
+        }
+        if (record.type == JOURNAL_RESERVE && record.value < first_expiration_time) {
+            first_expiration_time = record.value;
+        }
+    }
+    // Only the last write can be torn. A damaged record followed by an intact one was not lost in a crash,
+    // dropping it together with everything after it would silently lose durable reservations.
+    for (size_t position = end + sizeof(record); position + sizeof(record) <= size; position += sizeof(record)) {
+        memcpy(&record, mapping + position, sizeof(record));
+        if (record.checksum == record_checksum(&record)) {
+            fatal("journal is corrupted.");
+        }
+    }
+
+    // The wheel starts before every replayed expiration, the expired ones are removed by the first
+    // `check_outdated_reservations`.
+    TimerWheel *timers = &server->reservations.timers;
+    if (first_expiration_time <= timers->current_time) {
+        timers->current_time = first_expiration_time - 1;
+    }
+    for (size_t position = offset; position < end; position += sizeof(record)) {
+        memcpy(&record, mapping + position, sizeof(record));
+        apply_record(server, &record);
+    }
+    CHECK_ERRNO(munmap(mapping + mapping_offset, size - mapping_offset));
+
+    if (end < size) {
+        fprintf(stderr, "Journal of worker %zu: dropped %zu bytes of a torn write.\n", server->worker_id,
+                size - end);
+        CHECK_ERRNO(ftruncate(journal->fd, (off_t) end));
+        CHECK_ERRNO(fdatasync(journal->fd));
+        journal->size = end;
+    }
+}
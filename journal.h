@@ -0,0 +1,55 @@
+#ifndef _JOURNAL_
+#define _JOURNAL_
+
+#include "server.h"
+
+// "TICKJRN1" read as a little endian integer.
+#define JOURNAL_MAGIC 0x314e524a4b434954ULL
+#define JOURNAL_VERSION 1
+#define JOURNAL_INITIAL_CAPACITY 4096
+
+#define JOURNAL_RESERVE 1
+#define JOURNAL_ISSUE 2
+#define JOURNAL_EXPIRE 3
+
+// Written once when the journal of a worker is created. All workers share the cookie key, so the key of
+// the first journal is used for every restart.
+typedef struct JournalHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t worker_id;
+    uint64_t workers;
+    uint64_t event_count;
+    uint64_t cookie_key[2];
+} JournalHeader;
+
+// `value` is the expiration time of a reservation or the first ticket id of an issuance. The checksum
+// tells a complete record from one torn by a crash in the middle of a write.
+typedef struct __attribute__((__packed__)) JournalRecord {
+    uint8_t type;
+    uint16_t ticket_count;
+    uint32_t reservation_id;
+    uint32_t event_id;
+    uint64_t value;
+    uint32_t checksum;
+} JournalRecord;
+
+// Append-only log of the changes of one worker's state. Records of a batch are collected in memory and
+// written with a single write and fdatasync before any reply of the batch is sent.
+typedef struct Journal {
+    int fd;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    // Size of the file, everything before it is durable.
+    uint64_t size;
+} Journal;
+
+bool read_journal_header(const char *directory, size_t worker_id, JournalHeader *header);
+Journal *open_journal(const char *directory, const JournalHeader *header);
+void destroy_journal(Journal *journal);
+void append_journal_record(Journal *journal, JournalRecord record);
+void commit_journal(Server *server);
+void replay_journal(Server *server, uint64_t offset);
+
+#endif // _JOURNAL_
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "log.h"
+#include "server.h"
+
+#define LOG_LINE_SIZE 256
+#define LOG_BUFFER_SIZE 65536
+
+#define LOG_MESSAGE_LEVEL(id, level, format) [id] = level,
+const LogLevel log_message_levels[LOG_MESSAGE_COUNT] = { LOG_MESSAGES(LOG_MESSAGE_LEVEL) };
+#undef LOG_MESSAGE_LEVEL
+
+#define LOG_MESSAGE_FORMAT(id, level, format) [id] = format,
+static const char *log_formats[LOG_MESSAGE_COUNT] = { LOG_MESSAGES(LOG_MESSAGE_FORMAT) };
+#undef LOG_MESSAGE_FORMAT
+
+static const char *log_level_names[LOG_LEVELS] = {
+    [LOG_ERROR] = "error",
+    [LOG_WARNING] = "warning",
+    [LOG_INFO] = "info",
+    [LOG_DEBUG] = "debug",
+};
+
+_Atomic int log_level = LOG_WARNING;
+
+static LogRing *log_rings = NULL;
+static size_t log_ring_count = 0;
+static _Thread_local LogRing *thread_log_ring = NULL;
+
+bool parse_log_level(const char *name, LogLevel *level) {
+    for (int i = 0; i < LOG_LEVELS; i++) {
+        if (strcmp(name, log_level_names[i]) == 0) {
+            *level = (LogLevel) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *log_level_name(LogLevel level) {
+    return log_level_names[level];
+}
+
+void set_log_level(LogLevel level) {
+    atomic_store_explicit(&log_level, (int) level, memory_order_relaxed);
+}
+
+// Returns the length of the line, which is cut to fit in `size` bytes.
+static size_t format_record(char *buffer, size_t size, const LogRecord *record) {
+    const char *format = log_formats[record->values[0]];
+    size_t argument = 1;
+    size_t length = 0;
+
+    while (*format != '\0' && length + INET_ADDRSTRLEN + 21 < size) {
+        if (format[0] != '%' || format[1] == '\0') {
+            buffer[length++] = *format++;
+            continue;
+        }
+        uint64_t value = argument <= LOG_MAX_ARGUMENTS ? record->values[argument] : 0;
+        switch (format[1]) {
+            case 'u':
+                argument++;
+                length += (size_t) sprintf(buffer + length, "%lu", value);
+                break;
+            case 'd':
+                argument++;
+                length += (size_t) sprintf(buffer + length, "%ld", (int64_t) value);
+                break;
+            case 'a':
+                argument++;
+                inet_ntop(AF_INET, &(struct in_addr) { .s_addr = (uint32_t) value }, buffer + length,
+                          INET_ADDRSTRLEN);
+                length += strlen(buffer + length);
+                break;
+            default:
+                buffer[length++] = format[1];
+        }
+        format += 2;
+    }
+    return length;
+}
+
+static void write_log(const char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(STDERR_FILENO, buffer, length);
+        if (written < 0 && errno != EINTR) {
+            return;
+        }
+        buffer += written > 0 ? written : 0;
+        length -= written > 0 ? (size_t) written : 0;
+    }
+}
+
+void log_values(const uint64_t *values, size_t count) {
+    LogRecord record = { { 0 } };
+    memcpy(record.values, values, (count < 1 + LOG_MAX_ARGUMENTS ? count : 1 + LOG_MAX_ARGUMENTS) * sizeof(uint64_t));
+
+    LogRing *ring = thread_log_ring;
+    if (ring == NULL) {
+        char line[LOG_LINE_SIZE];
+        write_log(line, format_record(line, sizeof(line), &record));
+        return;
+    }
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SIZE) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return;
+    }
+    ring->records[tail & (LOG_RING_SIZE - 1)] = record;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Formats the records of a ring into the buffer, writing it out whenever it is full.
+static size_t drain_ring(size_t worker_id, LogRing *ring, char *buffer, size_t length) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    for (; head != tail; head++) {
+        if (length + LOG_LINE_SIZE > LOG_BUFFER_SIZE) {
+            write_log(buffer, length);
+            length = 0;
+        }
+        length += format_record(buffer + length, LOG_LINE_SIZE, &ring->records[head & (LOG_RING_SIZE - 1)]);
+    }
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+
+    uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->dropped_reported
+        && (int) log_message_levels[LOG_RECORDS_DROPPED] <= atomic_load_explicit(&log_level, memory_order_relaxed)) {
+        if (length + LOG_LINE_SIZE > LOG_BUFFER_SIZE) {
+            write_log(buffer, length);
+            length = 0;
+        }
+        LogRecord record = { { LOG_RECORDS_DROPPED, worker_id, dropped - ring->dropped_reported } };
+        length += format_record(buffer + length, LOG_LINE_SIZE, &record);
+    }
+    ring->dropped_reported = dropped;
+    return length;
+}
+
+static _Noreturn void *run_drainer(__attribute__ ((unused)) void *unused) {
+    char *buffer = safe_malloc(LOG_BUFFER_SIZE);
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_NS };
+
+    while (true) {
+        size_t length = 0;
+        for (size_t i = 0; i < log_ring_count; i++) {
+            length = drain_ring(i, &log_rings[i], buffer, length);
+        }
+        if (length > 0) {
+            write_log(buffer, length);
+        }
+        else {
+            nanosleep(&interval, NULL);
+        }
+    }
+}
+
+// Gives every worker a ring and starts the thread that drains them. Must be called before the workers start.
+void start_logger(size_t workers) {
+    log_rings = safe_malloc(workers * sizeof(LogRing));
+    memset(log_rings, 0, workers * sizeof(LogRing));
+    log_ring_count = workers;
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, run_drainer, NULL));
+    CHECK(pthread_detach(thread));
+}
+
+// Makes the calling thread log through the ring of the worker.
+void attach_log_ring(size_t worker_id) {
+    if (worker_id < log_ring_count) {
+        thread_log_ring = &log_rings[worker_id];
+    }
+}
+
+uint64_t log_records_dropped(void) {
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < log_ring_count; i++) {
+        dropped += atomic_load_explicit(&log_rings[i].dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
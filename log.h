@@ -0,0 +1,93 @@
+#ifndef _LOG_
+#define _LOG_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Records each worker can hold before the drainer catches up, a power of two.
+#define LOG_RING_SIZE 4096
+// A record holds the message id and up to this many arguments.
+#define LOG_MAX_ARGUMENTS 4
+// Time the drainer sleeps when it finds all rings empty.
+#define LOG_DRAIN_INTERVAL_NS 10000000
+
+typedef enum LogLevel {
+    LOG_ERROR,
+    LOG_WARNING,
+    LOG_INFO,
+    LOG_DEBUG,
+    LOG_LEVELS
+} LogLevel;
+
+// Formats are written by the drainer and know only %u and %d, unsigned and signed 64-bit integers, and %a, an
+// IPv4 address in network byte order.
+#define LOG_MESSAGES(X)                                                                                     \
+    X(LOG_WORKER_LISTENING, LOG_INFO, "Worker %u listening on port %u\n")                                   \
+    X(LOG_WORKER_LISTENING_URING, LOG_INFO, "Worker %u listening on port %u with io_uring\n")               \
+    X(LOG_METRICS_LISTENING, LOG_INFO, "Metrics available on port %u\n")                                    \
+    X(LOG_RECOVERED, LOG_INFO, "Worker %u recovered %u reservations.\n")                                    \
+    X(LOG_CATALOG_ADOPTED, LOG_INFO, "Worker %u uses catalog version %u.\n")                                \
+    X(LOG_BATCH_HANDLED, LOG_DEBUG, "Batch of %u requests handled, %u syscalls for %u requests so far.\n")   \
+    X(LOG_HOUSEKEEPING, LOG_DEBUG, "Housekeeping of worker %u, %u reservations pending.\n")                 \
+    X(LOG_RECEIVED, LOG_DEBUG, "Received %u bytes from client %a:%u at time: %d\n")                         \
+    X(LOG_IMPROPER_MESSAGE, LOG_DEBUG, "Improper message format.\n")                                        \
+    X(LOG_EVENTS_SENT, LOG_DEBUG, "Events sent.\n")                                                         \
+    X(LOG_EVENTS_PAGE_SENT, LOG_DEBUG, "Events page sent.\n")                                               \
+    X(LOG_BAD_REQUEST_SENT, LOG_DEBUG, "Bad request sent.\n")                                               \
+    X(LOG_PROCESSING_RESERVATION, LOG_DEBUG, "Processing reservation request...\n")                         \
+    X(LOG_RESERVATION_REPLAYED, LOG_DEBUG, "Reservation replayed.\n")                                       \
+    X(LOG_RESERVATION_ACCEPTED, LOG_DEBUG, "Reservation accepted. Confirmation sent.\n")                    \
+    X(LOG_PROCESSING_TICKETS, LOG_DEBUG, "Processing requested tickets...\n")                               \
+    X(LOG_TICKETS_SENT, LOG_DEBUG, "Tickets sent.\n")                                                       \
+    X(LOG_RECORDS_DROPPED, LOG_WARNING, "Worker %u dropped %u log records, its ring was full.\n")           \
+    X(LOG_ROUTER_LISTENING, LOG_INFO, "Router listening on port %u for %u nodes\n")                         \
+    X(LOG_NODE_NOT_ANSWERING, LOG_WARNING, "Node %u did not send the events, keeping the previous ones.\n")
+
+#define LOG_MESSAGE_ID(id, level, format) id,
+typedef enum LogMessage {
+    LOG_MESSAGES(LOG_MESSAGE_ID)
+    LOG_MESSAGE_COUNT
+} LogMessage;
+#undef LOG_MESSAGE_ID
+
+typedef struct LogRecord {
+    uint64_t values[1 + LOG_MAX_ARGUMENTS];
+} LogRecord;
+
+// Written only by its worker and read only by the drainer. Records that do not fit are dropped and counted,
+// the drainer reports the drops it has not reported yet.
+typedef struct LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t dropped;
+    uint64_t dropped_reported;
+} LogRing;
+
+extern const LogLevel log_message_levels[LOG_MESSAGE_COUNT];
+extern _Atomic int log_level;
+
+void log_values(const uint64_t *values, size_t count);
+
+// Logs the message `id`, with the arguments after it converted to 64-bit integers. The values are copied
+// into the ring of the calling worker and formatted by the drainer thread, threads without a ring write
+// the message right away.
+#define log_record(...)                                                                 \
+    do {                                                                                \
+        const uint64_t log_record_values[] = { __VA_ARGS__ };                           \
+        if ((int) log_message_levels[log_record_values[0]]                              \
+            <= atomic_load_explicit(&log_level, memory_order_relaxed)) {                \
+            log_values(log_record_values, sizeof(log_record_values) / sizeof(uint64_t)); \
+        }                                                                               \
+    } while (0)
+
+bool parse_log_level(const char *name, LogLevel *level);
+const char *log_level_name(LogLevel level);
+void set_log_level(LogLevel level);
+void start_logger(size_t workers);
+void attach_log_ring(size_t worker_id);
+uint64_t log_records_dropped(void);
+
+#endif // _LOG_
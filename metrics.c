@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "metrics.h"
+
+static const char *request_kind_names[REQUEST_KINDS] = {
+    [REQUEST_GET_EVENTS] = "get_events",
+    [REQUEST_GET_RESERVATION] = "get_reservation",
+    [REQUEST_GET_TICKETS] = "get_tickets",
+    [REQUEST_GET_EVENTS_PAGE] = "get_events_page",
+    [REQUEST_MALFORMED] = "malformed",
+};
+
+static const char *bad_request_reason_names[BAD_REQUEST_REASONS] = {
+    [BAD_EVENT_ID] = "bad_event_id",
+    [NO_TICKETS_REQUESTED] = "no_tickets_requested",
+    [TOO_MANY_TICKETS] = "too_many_tickets",
+    [NOT_ENOUGH_TICKETS] = "not_enough_tickets",
+    [UNKNOWN_RESERVATION] = "unknown_reservation",
+    [BAD_COOKIE] = "bad_cookie",
+    [RESERVATION_EXPIRED] = "reservation_expired",
+};
+
+const char *request_kind_name(RequestKind kind) {
+    return request_kind_names[kind];
+}
+
+static void add_metric_array(_Atomic uint64_t *total, const _Atomic uint64_t *metrics, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        metric_add(&total[i], metric_read(&metrics[i]));
+    }
+}
+
+// Sums the counters of a worker into `total`. They are read one by one while the worker runs, so the sum
+// is not a consistent snapshot of all of them.
+void add_metrics(Metrics *total, const Metrics *metrics) {
+    add_metric_array(total->requests, metrics->requests, REQUEST_KINDS);
+    add_metric_array(total->bad_requests, metrics->bad_requests, BAD_REQUEST_REASONS);
+    add_metric_array(&total->handling_time_buckets[0][0], &metrics->handling_time_buckets[0][0],
+                     REQUEST_KINDS * LATENCY_BUCKETS);
+    add_metric_array(total->handling_time_sum_ns, metrics->handling_time_sum_ns, REQUEST_KINDS);
+    metric_add(&total->syscalls, metric_read(&metrics->syscalls));
+    metric_add(&total->batches, metric_read(&metrics->batches));
+    metric_add(&total->tickets_issued, metric_read(&metrics->tickets_issued));
+    metric_add(&total->reservations_replayed, metric_read(&metrics->reservations_replayed));
+    metric_add(&total->tickets_cache_hits, metric_read(&metrics->tickets_cache_hits));
+    metric_add(&total->tickets_cache_misses, metric_read(&metrics->tickets_cache_misses));
+    add_metric_array(total->rate_limited, metrics->rate_limited, REQUEST_KINDS);
+    metric_add(&total->journal_commits, metric_read(&metrics->journal_commits));
+    metric_add(&total->journal_bytes, metric_read(&metrics->journal_bytes));
+    metric_add(&total->snapshots, metric_read(&metrics->snapshots));
+    metric_add(&total->snapshot_pause_ns, metric_read(&metrics->snapshot_pause_ns));
+    metric_add(&total->log_records_dropped, metric_read(&metrics->log_records_dropped));
+    metric_add(&total->reservations_pending, metric_read(&metrics->reservations_pending));
+    metric_add(&total->tickets_held, metric_read(&metrics->tickets_held));
+    metric_add(&total->tickets_cache_bytes, metric_read(&metrics->tickets_cache_bytes));
+}
+
+typedef struct MetricsWriter {
+    char *buffer;
+    size_t size;
+    size_t length;
+} MetricsWriter;
+
+__attribute__ ((format (printf, 2, 3)))
+static void write_metric(MetricsWriter *writer, const char *format, ...) {
+    if (writer->length >= writer->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(writer->buffer + writer->length, writer->size - writer->length, format, args);
+    va_end(args);
+    writer->length += written > 0 ? (size_t) written : 0;
+}
+
+static void write_header(MetricsWriter *writer, const char *name, const char *type, const char *help) {
+    write_metric(writer, "# HELP ticket_server_%s %s\n# TYPE ticket_server_%s %s\n", name, help, name, type);
+}
+
+// Writes the metrics in the Prometheus text exposition format, returns the length of the text. A text that
+// does not fit is cut at `size` bytes.
+size_t format_metrics(char *buffer, size_t size, const Metrics *total, size_t workers, uint64_t tickets_available) {
+    MetricsWriter writer = { .buffer = buffer, .size = size, .length = 0 };
+
+    write_header(&writer, "requests_total", "counter", "Well-formed requests received, by type.");
+    for (size_t kind = 0; kind < REQUEST_MALFORMED; kind++) {
+        write_metric(&writer, "ticket_server_requests_total{type=\"%s\"} %lu\n", request_kind_names[kind],
+                     metric_read(&total->requests[kind]));
+    }
+
+    write_header(&writer, "malformed_datagrams_dropped_total", "counter",
+                 "Datagrams dropped without a reply because they are not a valid request.");
+    write_metric(&writer, "ticket_server_malformed_datagrams_dropped_total %lu\n",
+                 metric_read(&total->requests[REQUEST_MALFORMED]));
+
+    write_header(&writer, "rate_limited_total", "counter",
+                 "Requests dropped without a reply because their source address went over its budget, by type.");
+    for (size_t kind = 0; kind < REQUEST_MALFORMED; kind++) {
+        write_metric(&writer, "ticket_server_rate_limited_total{type=\"%s\"} %lu\n", request_kind_names[kind],
+                     metric_read(&total->rate_limited[kind]));
+    }
+
+    write_header(&writer, "bad_requests_total", "counter", "BAD_REQUEST replies sent, by reason.");
+    for (size_t reason = 0; reason < BAD_REQUEST_REASONS; reason++) {
+        write_metric(&writer, "ticket_server_bad_requests_total{reason=\"%s\"} %lu\n",
+                     bad_request_reason_names[reason], metric_read(&total->bad_requests[reason]));
+    }
+
+    write_header(&writer, "handling_time_nanoseconds", "histogram",
+                 "Time from taking a datagram off the batch to queueing its reply, by request type.");
+    for (size_t kind = 0; kind < REQUEST_KINDS; kind++) {
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket + 1 < LATENCY_BUCKETS; bucket++) {
+            cumulative += metric_read(&total->handling_time_buckets[kind][bucket]);
+            write_metric(&writer, "ticket_server_handling_time_nanoseconds_bucket{type=\"%s\",le=\"%lu\"} %lu\n",
+                         request_kind_names[kind], (1UL << bucket) - 1, cumulative);
+        }
+        cumulative += metric_read(&total->handling_time_buckets[kind][LATENCY_BUCKETS - 1]);
+        write_metric(&writer, "ticket_server_handling_time_nanoseconds_bucket{type=\"%s\",le=\"+Inf\"} %lu\n",
+                     request_kind_names[kind], cumulative);
+        write_metric(&writer, "ticket_server_handling_time_nanoseconds_sum{type=\"%s\"} %lu\n",
+                     request_kind_names[kind], metric_read(&total->handling_time_sum_ns[kind]));
+        write_metric(&writer, "ticket_server_handling_time_nanoseconds_count{type=\"%s\"} %lu\n",
+                     request_kind_names[kind], cumulative);
+    }
+
+    write_header(&writer, "syscalls_total", "counter",
+                 "System calls of the workers: receives, sends, waits, journal commits and snapshot forks.");
+    write_metric(&writer, "ticket_server_syscalls_total %lu\n", metric_read(&total->syscalls));
+    write_header(&writer, "batches_total", "counter", "Batches of datagrams received.");
+    write_metric(&writer, "ticket_server_batches_total %lu\n", metric_read(&total->batches));
+    write_header(&writer, "tickets_issued_total", "counter", "Tickets handed out for picked up reservations.");
+    write_metric(&writer, "ticket_server_tickets_issued_total %lu\n", metric_read(&total->tickets_issued));
+    write_header(&writer, "reservations_replayed_total", "counter",
+                 "Repeated GET_RESERVATION answered with the original reply.");
+    write_metric(&writer, "ticket_server_reservations_replayed_total %lu\n",
+                 metric_read(&total->reservations_replayed));
+    write_header(&writer, "tickets_cache_hits_total", "counter",
+                 "GET_TICKETS answered with a cached TICKETS reply.");
+    write_metric(&writer, "ticket_server_tickets_cache_hits_total %lu\n", metric_read(&total->tickets_cache_hits));
+    write_header(&writer, "tickets_cache_misses_total", "counter",
+                 "GET_TICKETS whose TICKETS reply was encoded and cached.");
+    write_metric(&writer, "ticket_server_tickets_cache_misses_total %lu\n",
+                 metric_read(&total->tickets_cache_misses));
+    write_header(&writer, "journal_commits_total", "counter", "Group commits of the journal, one fdatasync each.");
+    write_metric(&writer, "ticket_server_journal_commits_total %lu\n", metric_read(&total->journal_commits));
+    write_header(&writer, "journal_bytes_total", "counter", "Bytes appended to the journal.");
+    write_metric(&writer, "ticket_server_journal_bytes_total %lu\n", metric_read(&total->journal_bytes));
+    write_header(&writer, "snapshots_total", "counter", "Snapshots written.");
+    write_metric(&writer, "ticket_server_snapshots_total %lu\n", metric_read(&total->snapshots));
+    write_header(&writer, "snapshot_pause_nanoseconds_total", "counter", "Time workers were paused to fork snapshots.");
+    write_metric(&writer, "ticket_server_snapshot_pause_nanoseconds_total %lu\n",
+                 metric_read(&total->snapshot_pause_ns));
+    write_header(&writer, "log_records_dropped_total", "counter", "Log records dropped because a log ring was full.");
+    write_metric(&writer, "ticket_server_log_records_dropped_total %lu\n",
+                 metric_read(&total->log_records_dropped));
+
+    write_header(&writer, "reservations_pending", "gauge", "Reservations whose tickets were not picked up yet.");
+    write_metric(&writer, "ticket_server_reservations_pending %lu\n", metric_read(&total->reservations_pending));
+    write_header(&writer, "tickets_held", "gauge", "Tickets held by pending reservations.");
+    write_metric(&writer, "ticket_server_tickets_held %lu\n", metric_read(&total->tickets_held));
+    write_header(&writer, "tickets_cache_bytes", "gauge", "Bytes of TICKETS replies kept for repeated GET_TICKETS.");
+    write_metric(&writer, "ticket_server_tickets_cache_bytes %lu\n", metric_read(&total->tickets_cache_bytes));
+    write_header(&writer, "tickets_available", "gauge", "Tickets that can still be reserved, over all events.");
+    write_metric(&writer, "ticket_server_tickets_available %lu\n", tickets_available);
+    write_header(&writer, "workers", "gauge", "Worker threads.");
+    write_metric(&writer, "ticket_server_workers %zu\n", workers);
+
+    return writer.length < size ? writer.length : size;
+}
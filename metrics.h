@@ -0,0 +1,109 @@
+#ifndef _METRICS_
+#define _METRICS_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Bucket `i` of a handling time histogram counts requests handled in less than 2^i nanoseconds,
+// the last bucket counts everything slower.
+#define LATENCY_BUCKETS 28
+
+typedef enum RequestKind {
+    REQUEST_GET_EVENTS,
+    REQUEST_GET_RESERVATION,
+    REQUEST_GET_TICKETS,
+    REQUEST_GET_EVENTS_PAGE,
+    // Empty, truncated, of an unknown type or of a wrong length, dropped without a reply.
+    REQUEST_MALFORMED,
+    REQUEST_KINDS
+} RequestKind;
+
+typedef enum BadRequestReason {
+    BAD_EVENT_ID,
+    NO_TICKETS_REQUESTED,
+    TOO_MANY_TICKETS,
+    NOT_ENOUGH_TICKETS,
+    UNKNOWN_RESERVATION,
+    BAD_COOKIE,
+    RESERVATION_EXPIRED,
+    BAD_REQUEST_REASONS
+} BadRequestReason;
+
+// Counters of one worker. Only the worker writes them, the admin thread reads them at any time, so they are
+// relaxed atomics updated with a plain load and store instead of a locked read-modify-write.
+typedef struct Metrics {
+    _Atomic uint64_t requests[REQUEST_KINDS];
+    _Atomic uint64_t bad_requests[BAD_REQUEST_REASONS];
+    _Atomic uint64_t handling_time_buckets[REQUEST_KINDS][LATENCY_BUCKETS];
+    _Atomic uint64_t handling_time_sum_ns[REQUEST_KINDS];
+    _Atomic uint64_t syscalls;
+    _Atomic uint64_t batches;
+    _Atomic uint64_t tickets_issued;
+    _Atomic uint64_t reservations_replayed;
+    // GET_TICKETS answered from the cache of encoded replies, and those that had to be encoded.
+    _Atomic uint64_t tickets_cache_hits;
+    _Atomic uint64_t tickets_cache_misses;
+    // Requests dropped because their source went over its budget, by type.
+    _Atomic uint64_t rate_limited[REQUEST_KINDS];
+    _Atomic uint64_t journal_commits;
+    _Atomic uint64_t journal_bytes;
+    _Atomic uint64_t snapshots;
+    // Time the worker spent forking the snapshot writers.
+    _Atomic uint64_t snapshot_pause_ns;
+    // Filled in from the log rings when the metrics are summed.
+    _Atomic uint64_t log_records_dropped;
+    // Gauges, reservations whose tickets were not picked up yet and the tickets they hold.
+    _Atomic uint64_t reservations_pending;
+    _Atomic uint64_t tickets_held;
+    _Atomic uint64_t tickets_cache_bytes;
+} Metrics;
+
+static inline void metric_add(_Atomic uint64_t *metric, uint64_t value) {
+    atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+static inline void metric_sub(_Atomic uint64_t *metric, uint64_t value) {
+    atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) - value,
+                          memory_order_relaxed);
+}
+
+static inline void metric_store(_Atomic uint64_t *metric, uint64_t value) {
+    atomic_store_explicit(metric, value, memory_order_relaxed);
+}
+
+static inline uint64_t metric_read(const _Atomic uint64_t *metric) {
+    return atomic_load_explicit(metric, memory_order_relaxed);
+}
+
+static inline uint64_t metric_requests(const Metrics *metrics) {
+    uint64_t requests = 0;
+    for (size_t kind = 0; kind < REQUEST_KINDS; kind++) {
+        requests += metric_read(&metrics->requests[kind]);
+    }
+    return requests;
+}
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ULL + (uint64_t) time.tv_nsec;
+}
+
+static inline void record_request(Metrics *metrics, RequestKind kind, uint64_t handling_time_ns) {
+    size_t bucket = handling_time_ns == 0 ? 0 : 64 - (size_t) __builtin_clzll(handling_time_ns);
+    if (bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    metric_add(&metrics->requests[kind], 1);
+    metric_add(&metrics->handling_time_buckets[kind][bucket], 1);
+    metric_add(&metrics->handling_time_sum_ns[kind], handling_time_ns);
+}
+
+const char *request_kind_name(RequestKind kind);
+void add_metrics(Metrics *total, const Metrics *metrics);
+size_t format_metrics(char *buffer, size_t size, const Metrics *total, size_t workers, uint64_t tickets_available);
+
+#endif // _METRICS_
@@ -0,0 +1,9 @@
+#define _GNU_SOURCE
+
+#include "protocol.h"
+
+#define REQUEST_LAYOUT(type, request_kind, message_size) [type] = { .kind = request_kind, .size = message_size },
+const RequestLayout request_layouts[256] = {
+    PROTOCOL_REQUESTS(REQUEST_LAYOUT)
+};
+#undef REQUEST_LAYOUT
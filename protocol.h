@@ -0,0 +1,207 @@
+#ifndef _PROTOCOL_
+#define _PROTOCOL_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+#define GET_EVENTS 1
+#define EVENTS 2
+#define GET_RESERVATION 3
+#define RESERVATION 4
+#define GET_TICKETS 5
+#define TICKETS 6
+// Paged extension, GET_EVENTS_PAGE asks for the page holding an event id. EVENTS_PAGE is followed by the id of
+// the first event of the next page, NO_MORE_EVENTS after the last one, and the events of the page as in EVENTS,
+// starting at the event asked for. Served directly or through a router, the first event is the same.
+#define GET_EVENTS_PAGE 7
+#define EVENTS_PAGE 8
+#define NO_MORE_EVENTS UINT32_MAX
+#define BAD_REQUEST 255
+
+// Between a cluster router and its nodes, the request or reply is preceded by the address and port of the
+// client, both in network byte order.
+#define FORWARD 9
+#define FORWARDED 10
+#define FORWARD_HEADER_SIZE 7
+
+#define COOKIE_SIZE 48
+#define TICKET_CODE_LENGTH 7
+#define MAX_MESSAGE_LENGTH 65507
+// Larger than any valid request, so that a truncated datagram can never pass the length checks.
+#define RECEIVE_BUFFER_SIZE 64
+
+static inline uint64_t htonll(uint64_t x) {
+    return ((((uint64_t)htonl(x)) << 32) + htonl((x) >> 32));
+}
+
+static inline uint64_t ntohll(uint64_t x) {
+    return htonll(x);
+}
+
+// Integers are read and written in network byte order, named after their types for the field lists below.
+static inline uint8_t read_uint8_t(const char *field) {
+    return (uint8_t) field[0];
+}
+
+static inline uint16_t read_uint16_t(const char *field) {
+    uint16_t value;
+    memcpy(&value, field, sizeof(value));
+    return ntohs(value);
+}
+
+static inline uint32_t read_uint32_t(const char *field) {
+    uint32_t value;
+    memcpy(&value, field, sizeof(value));
+    return ntohl(value);
+}
+
+static inline uint64_t read_uint64_t(const char *field) {
+    uint64_t value;
+    memcpy(&value, field, sizeof(value));
+    return ntohll(value);
+}
+
+static inline void write_uint8_t(char *field, uint8_t value) {
+    field[0] = (char) value;
+}
+
+static inline void write_uint16_t(char *field, uint16_t value) {
+    value = htons(value);
+    memcpy(field, &value, sizeof(value));
+}
+
+static inline void write_uint32_t(char *field, uint32_t value) {
+    value = htonl(value);
+    memcpy(field, &value, sizeof(value));
+}
+
+static inline void write_uint64_t(char *field, uint64_t value) {
+    value = htonll(value);
+    memcpy(field, &value, sizeof(value));
+}
+
+// Fields of every message after its type byte, in the order they are sent. `FIELD` is an integer, `BYTES` is
+// copied as it is. TICKETS is followed by the ticket codes and EVENTS by the event entries.
+#define GET_RESERVATION_FIELDS(FIELD, BYTES) FIELD(uint32_t, event_id) FIELD(uint16_t, ticket_count)
+#define GET_TICKETS_FIELDS(FIELD, BYTES) FIELD(uint32_t, reservation_id) BYTES(cookie, COOKIE_SIZE)
+#define GET_EVENTS_PAGE_FIELDS(FIELD, BYTES) FIELD(uint32_t, event_id)
+#define RESERVATION_FIELDS(FIELD, BYTES)                                                                    \
+    FIELD(uint32_t, reservation_id) FIELD(uint32_t, event_id) FIELD(uint16_t, ticket_count)                \
+    BYTES(cookie, COOKIE_SIZE) FIELD(uint64_t, expiration_time)
+#define TICKETS_FIELDS(FIELD, BYTES) FIELD(uint32_t, reservation_id) FIELD(uint16_t, ticket_count)
+#define EVENTS_PAGE_FIELDS(FIELD, BYTES) FIELD(uint32_t, next_event_id)
+#define BAD_REQUEST_FIELDS(FIELD, BYTES) FIELD(uint32_t, id)
+
+// Messages with fields, as (type, struct, function suffix).
+#define PROTOCOL_MESSAGES(X)                                                                                \
+    X(GET_RESERVATION, GetReservationMessage, get_reservation)                                             \
+    X(GET_TICKETS, GetTicketsMessage, get_tickets)                                                         \
+    X(GET_EVENTS_PAGE, GetEventsPageMessage, get_events_page)                                              \
+    X(RESERVATION, ReservationMessage, reservation)                                                        \
+    X(TICKETS, TicketsMessage, tickets)                                                                    \
+    X(EVENTS_PAGE, EventsPageMessage, events_page)                                                         \
+    X(BAD_REQUEST, BadRequestMessage, bad_request)
+
+#define PROTOCOL_STRUCT_FIELD(type, name) type name;
+#define PROTOCOL_STRUCT_BYTES(name, size) char name[size];
+#define PROTOCOL_FIELD_SIZE(type, name) + sizeof(type)
+#define PROTOCOL_BYTES_SIZE(name, size) + (size)
+#define PROTOCOL_DECODE_FIELD(type, name) message.name = read_##type(payload); payload += sizeof(type);
+#define PROTOCOL_DECODE_BYTES(name, size) memcpy(message.name, payload, size); payload += (size);
+#define PROTOCOL_ENCODE_FIELD(type, name) write_##type(buffer, message->name); buffer += sizeof(type);
+#define PROTOCOL_ENCODE_BYTES(name, size) memcpy(buffer, message->name, size); buffer += (size);
+
+// A host order struct, the size of the message with its type byte, a decoder of the bytes after the type
+// byte and an encoder of the whole message returning its size.
+#define DECLARE_MESSAGE(TYPE, Name, name)                                                                   \
+    typedef struct Name {                                                                                   \
+        TYPE##_FIELDS(PROTOCOL_STRUCT_FIELD, PROTOCOL_STRUCT_BYTES)                                         \
+    } Name;                                                                                                 \
+    enum { TYPE##_MESSAGE_SIZE = 1 TYPE##_FIELDS(PROTOCOL_FIELD_SIZE, PROTOCOL_BYTES_SIZE) };               \
+    _Static_assert(TYPE##_MESSAGE_SIZE <= MAX_MESSAGE_LENGTH, #TYPE " does not fit in a datagram");         \
+    static inline Name decode_##name(const char *payload) {                                                 \
+        Name message;                                                                                       \
+        TYPE##_FIELDS(PROTOCOL_DECODE_FIELD, PROTOCOL_DECODE_BYTES)                                         \
+        return message;                                                                                     \
+    }                                                                                                       \
+    static inline size_t encode_##name(char *buffer, const Name *message) {                                 \
+        *buffer++ = (char) TYPE;                                                                            \
+        TYPE##_FIELDS(PROTOCOL_ENCODE_FIELD, PROTOCOL_ENCODE_BYTES)                                         \
+        return TYPE##_MESSAGE_SIZE;                                                                         \
+    }
+
+PROTOCOL_MESSAGES(DECLARE_MESSAGE)
+#undef DECLARE_MESSAGE
+
+#define GET_EVENTS_MESSAGE_SIZE 1
+#define EVENTS_HEADER_SIZE 1
+#define EVENTS_PAGE_HEADER_SIZE EVENTS_PAGE_MESSAGE_SIZE
+
+// Entry of an event in EVENTS and EVENTS_PAGE, followed by `description_length` bytes of the description.
+#define EVENT_ENTRY_FIELDS(FIELD, BYTES)                                                                    \
+    FIELD(uint32_t, event_id) FIELD(uint16_t, ticket_count) FIELD(uint8_t, description_length)
+
+typedef struct EventEntry {
+    EVENT_ENTRY_FIELDS(PROTOCOL_STRUCT_FIELD, PROTOCOL_STRUCT_BYTES)
+} EventEntry;
+
+enum { EVENT_ENTRY_SIZE = 0 EVENT_ENTRY_FIELDS(PROTOCOL_FIELD_SIZE, PROTOCOL_BYTES_SIZE) };
+// The ticket count follows the event id, it is rewritten in place when tickets are taken or returned.
+#define EVENT_ENTRY_TICKET_COUNT_OFFSET sizeof(uint32_t)
+// Distance from the ticket count of an entry to its description, which follows the last field.
+#define EVENT_ENTRY_DESCRIPTION_DISTANCE (EVENT_ENTRY_SIZE - EVENT_ENTRY_TICKET_COUNT_OFFSET)
+
+static inline EventEntry decode_event_entry(const char *payload) {
+    EventEntry message;
+    EVENT_ENTRY_FIELDS(PROTOCOL_DECODE_FIELD, PROTOCOL_DECODE_BYTES)
+    return message;
+}
+
+static inline void encode_event_entry(char *buffer, const EventEntry *message) {
+    EVENT_ENTRY_FIELDS(PROTOCOL_ENCODE_FIELD, PROTOCOL_ENCODE_BYTES)
+}
+
+// Size of the entry with its description, whose length is the last field.
+static inline size_t event_entry_length(const char *entry) {
+    return EVENT_ENTRY_SIZE + read_uint8_t(entry + EVENT_ENTRY_SIZE - 1);
+}
+
+// Most ticket codes a TICKETS reply can carry.
+#define MAX_TICKETS_PER_MESSAGE ((MAX_MESSAGE_LENGTH - TICKETS_MESSAGE_SIZE) / TICKET_CODE_LENGTH)
+_Static_assert(MAX_TICKETS_PER_MESSAGE <= UINT16_MAX, "ticket count of TICKETS is 16-bit");
+
+// Requests, as (type, kind, size). Request sizes stay below the receive buffer, see RECEIVE_BUFFER_SIZE.
+#define PROTOCOL_REQUESTS(X)                                                                                \
+    X(GET_EVENTS, REQUEST_GET_EVENTS, GET_EVENTS_MESSAGE_SIZE)                                             \
+    X(GET_RESERVATION, REQUEST_GET_RESERVATION, GET_RESERVATION_MESSAGE_SIZE)                              \
+    X(GET_TICKETS, REQUEST_GET_TICKETS, GET_TICKETS_MESSAGE_SIZE)                                          \
+    X(GET_EVENTS_PAGE, REQUEST_GET_EVENTS_PAGE, GET_EVENTS_PAGE_MESSAGE_SIZE)
+
+#define CHECK_REQUEST_SIZE(type, kind, size) \
+    _Static_assert((size) > 0 && (size) < RECEIVE_BUFFER_SIZE, #type " does not fit in the receive buffer");
+PROTOCOL_REQUESTS(CHECK_REQUEST_SIZE)
+#undef CHECK_REQUEST_SIZE
+
+// Kind and size of the request of each type byte. Unused types have size 0, which no datagram that reaches
+// the table has.
+typedef struct RequestLayout {
+    uint8_t kind;
+    uint8_t size;
+} RequestLayout;
+
+extern const RequestLayout request_layouts[256];
+
+// A datagram is a request when its type byte is known and its length is the size of that type.
+static inline RequestKind request_kind_of(const char *buffer, size_t read_length) {
+    if (read_length == 0) {
+        return REQUEST_MALFORMED;
+    }
+    const RequestLayout *layout = &request_layouts[(uint8_t) buffer[0]];
+    return read_length == layout->size ? (RequestKind) layout->kind : REQUEST_MALFORMED;
+}
+
+#endif // _PROTOCOL_
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+
+#include "rate_limit.h"
+#include "server.h"
+
+#define MILLITOKENS 1000
+
+// Parses budgets such as "get_events=20/40,get_reservation=100/200", a type given as rate/burst.
+bool parse_rate_limits(const char *text, RateBudget budgets[RATE_LIMITED_KINDS]) {
+    while (*text != '\0') {
+        const char *equals = strchr(text, '=');
+        if (equals == NULL) {
+            return false;
+        }
+
+        size_t kind = 0;
+        size_t name_length = (size_t) (equals - text);
+        while (kind < RATE_LIMITED_KINDS && (strlen(request_kind_name(kind)) != name_length
+                                             || strncmp(request_kind_name(kind), text, name_length) != 0)) {
+            kind++;
+        }
+        if (kind == RATE_LIMITED_KINDS) {
+            return false;
+        }
+
+        char *ptr;
+        long rate = strtol(equals + 1, &ptr, 10);
+        if (*ptr != '/' || rate < 1 || rate > MAX_RATE_LIMIT) {
+            return false;
+        }
+        long burst = strtol(ptr + 1, &ptr, 10);
+        if ((*ptr != ',' && *ptr != '\0') || burst < 1 || burst > MAX_RATE_LIMIT) {
+            return false;
+        }
+
+        budgets[kind] = (RateBudget) { .rate = (uint32_t) rate, .burst = (uint32_t) burst };
+        text = *ptr == ',' ? ptr + 1 : ptr;
+    }
+    return true;
+}
+
+bool rate_limits_set(const RateBudget budgets[RATE_LIMITED_KINDS]) {
+    for (size_t kind = 0; kind < RATE_LIMITED_KINDS; kind++) {
+        if (budgets[kind].rate > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+RateLimiter new_rate_limiter(const RateBudget budgets[RATE_LIMITED_KINDS]) {
+    RateLimiter limiter = { .buckets = safe_malloc(RATE_LIMIT_BUCKETS * sizeof(RateBucket)) };
+    memset(limiter.buckets, 0, RATE_LIMIT_BUCKETS * sizeof(RateBucket));
+    memcpy(limiter.budgets, budgets, sizeof(limiter.budgets));
+    return limiter;
+}
+
+void destroy_rate_limiter(RateLimiter *limiter) {
+    free(limiter->buckets);
+    limiter->buckets = NULL;
+}
+
+static inline size_t bucket_index(uint32_t address) {
+    return (uint32_t) (address * 2654435761U) >> (32 - RATE_LIMIT_BUCKET_BITS);
+}
+
+static void fill_bucket(const RateLimiter *limiter, RateBucket *bucket, uint32_t elapsed_ms) {
+    for (size_t kind = 0; kind < RATE_LIMITED_KINDS; kind++) {
+        uint64_t capacity = (uint64_t) limiter->budgets[kind].burst * MILLITOKENS;
+        uint64_t tokens = bucket->tokens[kind] + (uint64_t) elapsed_ms * limiter->budgets[kind].rate;
+        bucket->tokens[kind] = (uint32_t) (tokens < capacity ? tokens : capacity);
+    }
+}
+
+// Takes a token of the type of the request from the bucket of its source, returns false when there is none
+// left and the request should be dropped.
+bool rate_limit_allows(RateLimiter *limiter, uint32_t address, RequestKind kind, uint64_t now_ns) {
+    if (kind >= RATE_LIMITED_KINDS || limiter->budgets[kind].rate == 0) {
+        return true;
+    }
+
+    uint32_t now_ms = (uint32_t) (now_ns / 1000000);
+    size_t index = bucket_index(address);
+    RateBucket *bucket = NULL;
+    RateBucket *oldest = NULL;
+    for (size_t i = 0; i < RATE_LIMIT_PROBES && bucket == NULL; i++) {
+        RateBucket *candidate = &limiter->buckets[(index + i) & (RATE_LIMIT_BUCKETS - 1)];
+        if (candidate->address == address) {
+            bucket = candidate;
+        }
+        else if (oldest == NULL || now_ms - candidate->time_ms > now_ms - oldest->time_ms) {
+            oldest = candidate;
+        }
+    }
+
+    if (bucket != NULL) {
+        fill_bucket(limiter, bucket, now_ms - bucket->time_ms);
+    }
+    else {
+        bucket = oldest;
+        bucket->address = address;
+        memset(bucket->tokens, 0, sizeof(bucket->tokens));
+        fill_bucket(limiter, bucket, UINT32_MAX);
+    }
+    bucket->time_ms = now_ms;
+
+    if (bucket->tokens[kind] < MILLITOKENS) {
+        return false;
+    }
+    bucket->tokens[kind] -= MILLITOKENS;
+    return true;
+}
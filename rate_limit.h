@@ -0,0 +1,44 @@
+#ifndef _RATE_LIMIT_
+#define _RATE_LIMIT_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "metrics.h"
+
+// Sources tracked by each worker. A source is looked for in this many consecutive buckets.
+#define RATE_LIMIT_BUCKET_BITS 12
+#define RATE_LIMIT_BUCKETS (1 << RATE_LIMIT_BUCKET_BITS)
+#define RATE_LIMIT_PROBES 4
+#define RATE_LIMITED_KINDS REQUEST_MALFORMED
+#define MAX_RATE_LIMIT 1000000
+
+// Requests of one type a source may send, `rate` per second on average and up to `burst` at once. A rate
+// of 0 leaves the type unlimited.
+typedef struct RateBudget {
+    uint32_t rate;
+    uint32_t burst;
+} RateBudget;
+
+// Token buckets of one source address, in thousandths of a token so that a millisecond refills exactly
+// `rate` of them.
+typedef struct RateBucket {
+    uint32_t address;
+    uint32_t time_ms;
+    uint32_t tokens[RATE_LIMITED_KINDS];
+} RateBucket;
+
+// Buckets of the sources a worker has seen recently. A new source takes the least recently used of its
+// probed buckets, a source that comes back after being pushed out starts with full buckets again.
+typedef struct RateLimiter {
+    RateBucket *buckets;
+    RateBudget budgets[RATE_LIMITED_KINDS];
+} RateLimiter;
+
+bool parse_rate_limits(const char *text, RateBudget budgets[RATE_LIMITED_KINDS]);
+bool rate_limits_set(const RateBudget budgets[RATE_LIMITED_KINDS]);
+RateLimiter new_rate_limiter(const RateBudget budgets[RATE_LIMITED_KINDS]);
+void destroy_rate_limiter(RateLimiter *limiter);
+bool rate_limit_allows(RateLimiter *limiter, uint32_t address, RequestKind kind, uint64_t now_ns);
+
+#endif // _RATE_LIMIT_
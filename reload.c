@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+
+#include "reload.h"
+
+Reloader *new_reloader(Server *servers, size_t workers, const char *events_path) {
+    CatalogVersion *version = safe_malloc(sizeof(CatalogVersion));
+    *version = (CatalogVersion) { .catalog = servers[0].catalog, .events_message = servers[0].events_message,
+                                  .number = 0, .next_retired = NULL };
+
+    Reloader *reloader = safe_malloc(sizeof(Reloader));
+    *reloader = (Reloader) { .servers = servers, .workers = workers, .events_path = events_path,
+                             .latest = version, .retired = NULL };
+    CHECK(pthread_mutex_init(&reloader->mutex, NULL));
+    for (size_t i = 0; i < workers; i++) {
+        servers[i].reloader = reloader;
+    }
+    return reloader;
+}
+
+// The shared events belong to the latest version, older ones own only their message and their file.
+static void release_version(CatalogVersion *version) {
+    destroy_events_message(version->events_message);
+    free(version->catalog.configured_tickets);
+    if (version->catalog.mapping != NULL) {
+        CHECK_ERRNO(munmap(version->catalog.mapping, version->catalog.mapping_size));
+    }
+    free(version);
+}
+
+static void release_retired_versions(Reloader *reloader) {
+    uint64_t oldest_adopted = UINT64_MAX;
+    for (size_t i = 0; i < reloader->workers; i++) {
+        uint64_t adopted = atomic_load_explicit(&reloader->servers[i].catalog_version, memory_order_acquire);
+        oldest_adopted = adopted < oldest_adopted ? adopted : oldest_adopted;
+    }
+
+    CatalogVersion **link = &reloader->retired;
+    while (*link != NULL) {
+        CatalogVersion *version = *link;
+        if (version->number < oldest_adopted) {
+            *link = version->next_retired;
+            release_version(version);
+        }
+        else {
+            link = &version->next_retired;
+        }
+    }
+}
+
+void destroy_reloader(Reloader *reloader) {
+    CatalogVersion *latest = atomic_load_explicit(&reloader->latest, memory_order_relaxed);
+    while (reloader->retired != NULL) {
+        CatalogVersion *version = reloader->retired;
+        reloader->retired = version->next_retired;
+        release_version(version);
+    }
+    destroy_events_message(latest->events_message);
+    destroy_catalog(&latest->catalog);
+    free(latest);
+    CHECK(pthread_mutex_destroy(&reloader->mutex));
+    free(reloader);
+}
+
+// Events are identified by their position, so the new file may only change ticket counts and append
+// events. Anything else leaves the current catalog in place. Descriptions are compared with those in the
+// pages, the file the catalog was loaded from may have been rewritten since.
+static bool extends_catalog(const CatalogVersion *current, const Catalog *next, char *status, size_t status_size) {
+    const Catalog *catalog = &current->catalog;
+    if (next->count < catalog->count) {
+        snprintf(status, status_size, "reload failed: %zu events removed.\n", catalog->count - next->count);
+        return false;
+    }
+    for (size_t i = 0; i < catalog->count; i++) {
+        const char *description = current->events_message->pages + catalog->page_ticket_count_offsets[i]
+                                  + EVENT_ENTRY_DESCRIPTION_DISTANCE;
+        if (catalog->description_lengths[i] != next->description_lengths[i]
+            || memcmp(description, event_description(next, i), catalog->description_lengths[i]) != 0) {
+            snprintf(status, status_size, "reload failed: description of event %zu changed.\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parses the events file again off the request path and publishes the merged catalog.
+bool reload_catalog(Reloader *reloader, char *status, size_t status_size) {
+    FILE *file_ptr = fopen(reloader->events_path, "r");
+    if (!file_ptr) {
+        snprintf(status, status_size, "reload failed: opening of the events file failed.\n");
+        return false;
+    }
+    Catalog next;
+    const char *error;
+    if (!load_catalog(file_ptr, &next, &error)) {
+        snprintf(status, status_size, "reload failed: %s\n", error);
+        return false;
+    }
+
+    CHECK(pthread_mutex_lock(&reloader->mutex));
+    release_retired_versions(reloader);
+    CatalogVersion *current = atomic_load_explicit(&reloader->latest, memory_order_relaxed);
+    if (!extends_catalog(current, &next, status, status_size)
+        || !adjust_ticket_counts(&current->catalog, &next, status, status_size)) {
+        CHECK(pthread_mutex_unlock(&reloader->mutex));
+        destroy_catalog(&next);
+        return false;
+    }
+
+    size_t added = next.count - current->catalog.count;
+    CatalogVersion *version = safe_malloc(sizeof(CatalogVersion));
+    version->events_message = merge_catalog(&current->catalog, current->events_message, &next);
+    version->catalog = next;
+    version->number = current->number + 1;
+    version->next_retired = NULL;
+
+    current->next_retired = reloader->retired;
+    reloader->retired = current;
+    atomic_store_explicit(&reloader->latest, version, memory_order_release);
+    // Counts changed while the message was copied are refreshed here, off the request path. A worker still
+    // on the previous version patches the counts it changes after this itself when it adopts the new one.
+    for (size_t i = 0; i < next.count; i++) {
+        write_event_ticket_count(version->events_message, &version->catalog, (uint32_t) i);
+    }
+    CHECK(pthread_mutex_unlock(&reloader->mutex));
+
+    snprintf(status, status_size, "reloaded %zu events, %zu new.\n", next.count, added);
+    return true;
+}
+
+// Called between batches, when no reply waiting to be sent refers to the EVENTS message. Counts the worker
+// changed since it last looked may have been written only to the previous message, only those are patched.
+void adopt_latest_catalog(Server *server) {
+    CatalogVersion *version = atomic_load_explicit(&server->reloader->latest, memory_order_acquire);
+    size_t changed_event_count = server->changed_event_count;
+    server->changed_event_count = 0;
+    if (version->number == atomic_load_explicit(&server->catalog_version, memory_order_relaxed)) {
+        return;
+    }
+
+    server->catalog = version->catalog;
+    server->events_message = version->events_message;
+    if (changed_event_count > CHANGED_EVENTS_CAPACITY) {
+        for (size_t i = 0; i < server->catalog.count; i++) {
+            write_event_ticket_count(server->events_message, &server->catalog, (uint32_t) i);
+        }
+    }
+    else {
+        for (size_t i = 0; i < changed_event_count; i++) {
+            write_event_ticket_count(server->events_message, &server->catalog, server->changed_events[i]);
+        }
+    }
+    atomic_store_explicit(&server->catalog_version, version->number, memory_order_release);
+    log_record(LOG_CATALOG_ADOPTED, server->worker_id, version->number);
+}
@@ -0,0 +1,32 @@
+#ifndef _RELOAD_
+#define _RELOAD_
+
+#include <pthread.h>
+
+#include "server.h"
+
+// Catalog and EVENTS message published by a reload. Versions are never changed after they are published.
+typedef struct CatalogVersion {
+    Catalog catalog;
+    EventsMessage *events_message;
+    uint64_t number;
+    struct CatalogVersion *next_retired;
+} CatalogVersion;
+
+// Reloads the events file on SIGHUP or on a request to the admin port. Workers pick up the latest version
+// between batches, a replaced version is freed once every worker has moved past it.
+typedef struct Reloader {
+    Server *servers;
+    size_t workers;
+    const char *events_path;
+    pthread_mutex_t mutex;
+    _Atomic(CatalogVersion *) latest;
+    CatalogVersion *retired;
+} Reloader;
+
+Reloader *new_reloader(Server *servers, size_t workers, const char *events_path);
+void destroy_reloader(Reloader *reloader);
+bool reload_catalog(Reloader *reloader, char *status, size_t status_size);
+void adopt_latest_catalog(Server *server);
+
+#endif // _RELOAD_
@@ -0,0 +1,897 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "uring.h"
+#include "journal.h"
+#include "trace.h"
+
+void fatal(const char *message) {
+    fprintf(stderr, "Error: %s\n", message);
+    exit(1);
+}
+
+void *safe_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) {
+        fatal("memory allocation failed.");
+    }
+    return ptr;
+}
+
+void *safe_realloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (!ptr) {
+        fatal("memory allocation failed.");
+    }
+    return ptr;
+}
+
+static inline uint64_t rotl64(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND(v0, v1, v2, v3)                                              \
+    do {                                                                      \
+        v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);         \
+        v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;                              \
+        v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;                              \
+        v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);         \
+    } while (0)
+
+// SipHash-2-4 of a message of three little endian 64-bit words.
+uint64_t siphash24(const uint64_t key[2], const uint64_t words[3]) {
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t m = i < 3 ? words[i] : (uint64_t) (3 * sizeof(uint64_t)) << 56;
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    v2 ^= 0xff;
+    for (size_t i = 0; i < 4; i++) {
+        SIPROUND(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+bool take_tickets(Catalog *catalog, uint32_t event_id, uint16_t ticket_count) {
+    uint16_t available = available_tickets(catalog, event_id);
+    do {
+        if (available < ticket_count) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&catalog->tickets[event_id], &available, available - ticket_count,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+
+void return_tickets(Catalog *catalog, uint32_t event_id, uint16_t ticket_count) {
+    atomic_fetch_add_explicit(&catalog->tickets[event_id], ticket_count, memory_order_relaxed);
+}
+
+MessageBatch new_message_batch(size_t capacity, size_t buffer_size) {
+    MessageBatch batch = (MessageBatch) {
+        .headers = safe_malloc(capacity * sizeof(struct mmsghdr)),
+        .iovecs = safe_malloc(capacity * sizeof(struct iovec)),
+        .addresses = safe_malloc(capacity * sizeof(struct sockaddr_in)),
+        .buffers = safe_malloc(capacity * buffer_size),
+        .buffer_size = buffer_size, .capacity = capacity, .count = 0 };
+
+    memset(batch.headers, 0, capacity * sizeof(struct mmsghdr));
+    for (size_t i = 0; i < capacity; i++) {
+        batch.iovecs[i] = (struct iovec) { .iov_base = batch.buffers + i * buffer_size, .iov_len = buffer_size };
+        batch.headers[i].msg_hdr.msg_iov = &batch.iovecs[i];
+        batch.headers[i].msg_hdr.msg_iovlen = 1;
+        batch.headers[i].msg_hdr.msg_name = &batch.addresses[i];
+        batch.headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    return batch;
+}
+
+void destroy_message_batch(MessageBatch *batch) {
+    free(batch->headers);
+    free(batch->iovecs);
+    free(batch->addresses);
+    free(batch->buffers);
+}
+
+ReservationsContainer new_reservations_container(uint32_t first_id, uint32_t id_step, uint64_t current_time,
+                                                 const uint64_t cookie_key[2]) {
+    size_t capacity = INITIAL_RESERVATIONS_CAPACITY;
+    Reservation *slots = safe_malloc(capacity * sizeof(Reservation));
+    memset(slots, 0, capacity * sizeof(Reservation));
+    ReservationsContainer reservations = (ReservationsContainer) { .slots = slots, .capacity = capacity,
+            .count = 0, .next_sequence = 0, .first_id = first_id, .id_step = id_step };
+    reservations.timers.current_time = current_time;
+    memcpy(reservations.cookie_key, cookie_key, sizeof(reservations.cookie_key));
+    return reservations;
+}
+
+Reservation *get_reservation(ReservationsContainer *reservations, uint32_t reservation_id) {
+    if (reservation_id < reservations->first_id) {
+        return NULL;
+    }
+    uint32_t offset = reservation_id - reservations->first_id;
+    uint64_t sequence = offset / reservations->id_step;
+    if (offset % reservations->id_step != 0 || sequence >= reservations->next_sequence) {
+        return NULL;
+    }
+
+    Reservation *reservation = reservation_slot(reservations, sequence);
+    return reservation->reservation_id == reservation_id ? reservation : NULL;
+}
+
+// Live reservations have distinct sequence numbers modulo the capacity, so they stay distinct modulo
+// the doubled capacity.
+void grow_reservations_container(ReservationsContainer *reservations) {
+    Reservation *old_slots = reservations->slots;
+    size_t old_capacity = reservations->capacity;
+
+    reservations->capacity *= 2;
+    reservations->slots = safe_malloc(reservations->capacity * sizeof(Reservation));
+    memset(reservations->slots, 0, reservations->capacity * sizeof(Reservation));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].reservation_id != 0) {
+            uint64_t sequence = (old_slots[i].reservation_id - reservations->first_id) / reservations->id_step;
+            *reservation_slot(reservations, sequence) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Returns an empty slot with its reservation id set.
+Reservation *insert_reservation(ReservationsContainer *reservations) {
+    if (8 * (reservations->count + 1) > 7 * reservations->capacity) {
+        grow_reservations_container(reservations);
+    }
+
+    Reservation *reservation;
+    while ((reservation = reservation_slot(reservations, reservations->next_sequence))->reservation_id != 0) {
+        reservations->next_sequence++;
+    }
+    reservation->reservation_id = reservation_id_of(reservations, reservations->next_sequence++);
+    reservations->count++;
+    return reservation;
+}
+
+// Inserts the reservation under the id it had before a restart. Ids are replayed in the order they were
+// handed out, so the container grows exactly as it did then.
+Reservation *insert_reservation_with_id(ReservationsContainer *reservations, uint32_t reservation_id) {
+    uint64_t sequence = (reservation_id - reservations->first_id) / reservations->id_step;
+    while (8 * (reservations->count + 1) > 7 * reservations->capacity
+           || reservation_slot(reservations, sequence)->reservation_id != 0) {
+        grow_reservations_container(reservations);
+    }
+
+    Reservation *reservation = reservation_slot(reservations, sequence);
+    reservation->reservation_id = reservation_id;
+    if (sequence >= reservations->next_sequence) {
+        reservations->next_sequence = sequence + 1;
+    }
+    reservations->count++;
+    return reservation;
+}
+
+void remove_reservation(ReservationsContainer *reservations, Reservation *reservation) {
+    reservation->reservation_id = 0;
+    reservations->count--;
+}
+
+static inline size_t timer_slot_index(uint64_t current_time, uint64_t expiration_time) {
+    uint64_t delay = expiration_time - current_time;
+    size_t level = 0;
+    while (level + 1 < TIMER_LEVELS && (delay >> (TIMER_LEVEL_BITS * (level + 1))) != 0) {
+        level++;
+    }
+    return level * TIMER_SLOTS + ((expiration_time >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1));
+}
+
+// The reservation must expire after the current time of the wheel.
+void add_timer(ReservationsContainer *reservations, Reservation *reservation) {
+    TimerWheel *timers = &reservations->timers;
+    size_t index = timer_slot_index(timers->current_time, reservation->expiration_time);
+
+    reservation->timer_prev = index;
+    reservation->timer_next = timers->slots[index];
+    if (reservation->timer_next != 0) {
+        get_reservation(reservations, reservation->timer_next)->timer_prev = reservation->reservation_id;
+    }
+    timers->slots[index] = reservation->reservation_id;
+    timers->count++;
+}
+
+void cancel_timer(ReservationsContainer *reservations, Reservation *reservation) {
+    TimerWheel *timers = &reservations->timers;
+
+    if (reservation->timer_prev <= TIMER_EXPIRING_SLOT) {
+        timers->slots[reservation->timer_prev] = reservation->timer_next;
+    }
+    else {
+        get_reservation(reservations, reservation->timer_prev)->timer_next = reservation->timer_next;
+    }
+    if (reservation->timer_next != 0) {
+        get_reservation(reservations, reservation->timer_next)->timer_prev = reservation->timer_prev;
+    }
+    timers->count--;
+}
+
+// Detaches the list of reservations from the slot, returns the id of the first one.
+uint32_t take_timers(TimerWheel *timers, size_t index) {
+    uint32_t reservation_id = timers->slots[index];
+    timers->slots[index] = 0;
+    return reservation_id;
+}
+
+// Moves the slot of a higher level that the current time has just reached to the lower levels.
+void cascade_timers(ReservationsContainer *reservations, size_t level) {
+    TimerWheel *timers = &reservations->timers;
+    size_t slot = (timers->current_time >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);
+    uint32_t reservation_id = take_timers(timers, level * TIMER_SLOTS + slot);
+
+    while (reservation_id != 0) {
+        Reservation *reservation = get_reservation(reservations, reservation_id);
+        reservation_id = reservation->timer_next;
+        timers->count--;
+        add_timer(reservations, reservation);
+    }
+}
+
+// Each worker owns its reservations and hands out reservation ids and ticket ids from its own range,
+// only the ticket counts of the events are shared. In a cluster the ranges are split between the nodes first.
+Server initialize_server(Parameters parameters, Catalog catalog, EventsMessage *events_message,
+                         const uint64_t cookie_key[2], size_t worker_id, int socket_fd) {
+    uint64_t current_time = time(NULL);
+    size_t workers = parameters.workers;
+    size_t nodes = parameters.nodes == 0 ? 1 : parameters.nodes;
+
+    uint32_t first_id = node_first_reservation_id(parameters.node, nodes) + (uint32_t) worker_id;
+    ReservationsContainer reservations = new_reservations_container(first_id, workers, current_time, cookie_key);
+    int64_t ticket_id_range = TICKET_ID_SPACE / (int64_t) (nodes * workers);
+    Server server = (Server) { .parameters = parameters, .worker_id = worker_id, .catalog = catalog,
+            .socket_fd = socket_fd, .reservations =  reservations,
+            .next_ticket_id = (int64_t) (parameters.node * workers + worker_id) * ticket_id_range,
+            .time_when_received = current_time, .events_message = events_message,
+            .incoming = new_message_batch(parameters.batch_size, RECEIVE_BUFFER_SIZE),
+            .outgoing = new_message_batch(parameters.batch_size, MAX_MESSAGE_LENGTH), .replay_cache = NULL,
+            .rate_limiter = { .buckets = NULL }, .tickets_cache = { .entries = NULL }, .forward_address = NULL };
+
+    if (rate_limits_set(parameters.rate_limits)) {
+        server.rate_limiter = new_rate_limiter(parameters.rate_limits);
+    }
+
+    if (parameters.retransmission_window > 0) {
+        server.replay_cache = safe_malloc(REPLAY_CACHE_SIZE * sizeof(ReplayEntry));
+        memset(server.replay_cache, 0, REPLAY_CACHE_SIZE * sizeof(ReplayEntry));
+    }
+
+    if (parameters.tickets_cache_bytes > 0) {
+        server.tickets_cache = new_tickets_cache(parameters.tickets_cache_bytes);
+    }
+
+    return server;
+}
+
+// Space for the reply to the request that is currently processed.
+char *next_reply_buffer(Server *server) {
+    MessageBatch *batch = &server->outgoing;
+    return batch->buffers + batch->count * batch->buffer_size;
+}
+
+// Queues the reply, it is sent with the rest of the batch by `flush_messages`. The reply to a forwarded request
+// goes to the router, after the address of the client, so it must be in the reply buffer with room for it.
+void send_message(Server *server, const struct sockaddr_in *client_address, const char *message, size_t length) {
+    MessageBatch *batch = &server->outgoing;
+    ENSURE(batch->count < batch->capacity);
+
+    if (server->forward_address != NULL) {
+        char *wrapped = next_reply_buffer(server);
+        ENSURE(message == wrapped && length + FORWARD_HEADER_SIZE <= batch->buffer_size);
+        memmove(wrapped + FORWARD_HEADER_SIZE, wrapped, length);
+        wrapped[0] = FORWARDED;
+        memcpy(wrapped + 1, &client_address->sin_addr.s_addr, 4);
+        memcpy(wrapped + 5, &client_address->sin_port, 2);
+        client_address = server->forward_address;
+        length += FORWARD_HEADER_SIZE;
+    }
+
+    batch->addresses[batch->count] = *client_address;
+    batch->iovecs[batch->count] = (struct iovec) { .iov_base = (void *) message, .iov_len = length };
+    batch->count++;
+}
+
+void flush_messages(Server *server) {
+    // Replies are released only when the changes they confirm are durable.
+    commit_journal(server);
+    if (server->trace != NULL) {
+        write_trace(server->trace);
+    }
+    if (server->replay != NULL) {
+        digest_replies(server);
+        return;
+    }
+
+    if (server->uring != NULL) {
+        uring_flush_messages(server);
+        return;
+    }
+
+    MessageBatch *batch = &server->outgoing;
+    size_t sent_count = 0;
+
+    while (sent_count < batch->count) {
+        int sent = sendmmsg(server->socket_fd, batch->headers + sent_count, batch->count - sent_count, 0);
+        ENSURE(sent > 0);
+        metric_add(&server->metrics.syscalls, 1);
+        for (int i = 0; i < sent; i++) {
+            ENSURE(batch->headers[sent_count + i].msg_len == batch->iovecs[sent_count + i].iov_len);
+        }
+        sent_count += sent;
+    }
+    batch->count = 0;
+    server->events_message_queued = false;
+}
+
+// Other workers may update the same field concurrently, so it is rewritten until it matches the counter,
+// the last writer leaves it current.
+static void write_ticket_count(char *field, const Catalog *catalog, uint32_t event_id) {
+    uint16_t ticket_count;
+    do {
+        ticket_count = available_tickets(catalog, event_id);
+        write_uint16_t(field, ticket_count);
+    } while (ticket_count != available_tickets(catalog, event_id));
+}
+
+// Writes the current ticket count of the event into the EVENTS message and into its page.
+void write_event_ticket_count(EventsMessage *events_message, const Catalog *catalog, uint32_t event_id) {
+    if (catalog->ticket_count_offsets[event_id] != 0) {
+        write_ticket_count(events_message->message + catalog->ticket_count_offsets[event_id], catalog, event_id);
+    }
+    write_ticket_count(events_message->pages + catalog->page_ticket_count_offsets[event_id], catalog, event_id);
+}
+
+void update_events_message(Server *server, uint32_t event_id) {
+    if (server->events_message_queued) {
+        flush_messages(server);
+    }
+
+    write_event_ticket_count(server->events_message, &server->catalog, event_id);
+    if (server->reloader != NULL) {
+        if (server->changed_event_count < CHANGED_EVENTS_CAPACITY) {
+            server->changed_events[server->changed_event_count] = event_id;
+        }
+        server->changed_event_count++;
+    }
+}
+
+// Copies an EVENTS message or page into the reply buffer, from the event `first_event_id` on and without the
+// events that would not fit with the header of a forwarded reply. A page that is cut points to the first
+// event left out.
+static void send_forwarded_events(Server *server, struct sockaddr_in client_address, const char *message,
+                                  size_t length, size_t header_size, uint32_t first_event_id) {
+    size_t start = header_size;
+    while (start < length && read_uint32_t(message + start) < first_event_id) {
+        start += event_entry_length(message + start);
+    }
+    size_t end = start;
+    while (end < length && end - start + header_size + event_entry_length(message + end)
+                           <= MAX_MESSAGE_LENGTH - FORWARD_HEADER_SIZE) {
+        end += event_entry_length(message + end);
+    }
+
+    char *reply = next_reply_buffer(server);
+    memcpy(reply, message, header_size);
+    memcpy(reply + header_size, message + start, end - start);
+    if (end < length && header_size == EVENTS_PAGE_HEADER_SIZE) {
+        memcpy(reply + 1, message + end, 4);
+    }
+    send_message(server, &client_address, reply, header_size + end - start);
+}
+
+void send_events(Server *server, struct sockaddr_in client_address) {
+    EventsMessage *events_message = server->events_message;
+
+    if (server->forward_address != NULL) {
+        send_forwarded_events(server, client_address, events_message->message, events_message->length,
+                              EVENTS_HEADER_SIZE, 0);
+        log_record(LOG_EVENTS_SENT);
+        return;
+    }
+
+    // With a journal every flush costs an fdatasync, so the reply gets a copy of the message instead of
+    // forcing an early flush when the message changes.
+    if (server->journal != NULL) {
+        char *message = next_reply_buffer(server);
+        memcpy(message, events_message->message, events_message->length);
+        send_message(server, &client_address, message, events_message->length);
+        log_record(LOG_EVENTS_SENT);
+        return;
+    }
+
+    send_message(server, &client_address, events_message->message, events_message->length);
+    server->events_message_queued = true;
+    log_record(LOG_EVENTS_SENT);
+}
+
+// Replies with the page holding the event, found by a binary search of the page table, from the event on.
+void send_events_page(Server *server, uint32_t event_id, struct sockaddr_in client_address) {
+    if (event_id >= server->catalog.count) {
+        send_bad_request(event_id, server, client_address, BAD_EVENT_ID);
+        return;
+    }
+
+    EventsMessage *events_message = server->events_message;
+    size_t low = 0;
+    size_t high = events_message->page_count;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (events_message->page_table[middle].first_event_id <= event_id) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    char *page = events_message->pages + events_message->page_table[low].offset;
+    size_t length = events_message->page_table[low + 1].offset - events_message->page_table[low].offset;
+
+    if (server->forward_address != NULL) {
+        send_forwarded_events(server, client_address, page, length, EVENTS_PAGE_HEADER_SIZE, event_id);
+        log_record(LOG_EVENTS_PAGE_SENT);
+        return;
+    }
+
+    // A reply that leaves out the events before the one asked for is a copy, so is one sent with a journal,
+    // as in `send_events`.
+    size_t start = server->catalog.page_ticket_count_offsets[event_id] - EVENT_ENTRY_TICKET_COUNT_OFFSET
+                   - events_message->page_table[low].offset;
+    if (server->journal != NULL || start > EVENTS_PAGE_HEADER_SIZE) {
+        char *message = next_reply_buffer(server);
+        memcpy(message, page, EVENTS_PAGE_HEADER_SIZE);
+        memcpy(message + EVENTS_PAGE_HEADER_SIZE, page + start, length - start);
+        send_message(server, &client_address, message, EVENTS_PAGE_HEADER_SIZE + length - start);
+        log_record(LOG_EVENTS_PAGE_SENT);
+        return;
+    }
+
+    send_message(server, &client_address, page, length);
+    server->events_message_queued = true;
+    log_record(LOG_EVENTS_PAGE_SENT);
+}
+
+void send_bad_request(uint32_t id, Server *server, struct sockaddr_in client_address, BadRequestReason reason) {
+    metric_add(&server->metrics.bad_requests[reason], 1);
+    char *message = next_reply_buffer(server);
+    BadRequestMessage bad_request = { .id = id };
+    send_message(server, &client_address, message, encode_bad_request(message, &bad_request));
+    log_record(LOG_BAD_REQUEST_SENT);
+}
+
+// Cookies are not stored, they are a keyed MAC of the reservation written with characters 33 to 126.
+void compute_cookie(char *cookie, const uint64_t key[2], const Reservation *reservation) {
+    uint64_t words[3] = { reservation->reservation_id | (uint64_t) reservation->event_id << 32,
+                          reservation->expiration_time, reservation->ticket_count };
+
+    for (size_t i = 0; i < COOKIE_SIZE / COOKIE_CHARACTERS_PER_HASH; i++) {
+        words[2] = reservation->ticket_count | (uint64_t) i << 16;
+        uint64_t hash = siphash24(key, words);
+        for (size_t j = 0; j < COOKIE_CHARACTERS_PER_HASH; j++) {
+            cookie[i * COOKIE_CHARACTERS_PER_HASH + j] = (char) (33 + hash % 94);
+            hash /= 94;
+        }
+    }
+}
+
+Reservation *add_new_reservation(Server *server, uint32_t event_id, uint16_t ticket_count) {
+    Reservation *reservation = insert_reservation(&server->reservations);
+    reservation->event_id = event_id;
+    reservation->ticket_count = ticket_count;
+    reservation->expiration_time = server->time_when_received + server->parameters.time_limit;
+    reservation->first_ticket_id = NO_TICKETS;
+    add_timer(&server->reservations, reservation);
+    metric_add(&server->metrics.reservations_pending, 1);
+    metric_add(&server->metrics.tickets_held, ticket_count);
+    if (server->journal != NULL) {
+        append_journal_record(server->journal, (JournalRecord) { .type = JOURNAL_RESERVE,
+                .ticket_count = ticket_count, .reservation_id = reservation->reservation_id,
+                .event_id = event_id, .value = reservation->expiration_time });
+    }
+
+    return reservation;
+}
+
+static inline size_t replay_cache_index(const struct sockaddr_in *client_address, uint32_t event_id,
+                                        uint16_t ticket_count) {
+    uint64_t client = (uint64_t) client_address->sin_addr.s_addr << 16 | client_address->sin_port;
+    uint64_t request = (uint64_t) event_id << 16 | ticket_count;
+    uint64_t hash = client * 0x9e3779b97f4a7c15ULL ^ request * 0xc2b2ae3d27d4eb4fULL;
+    return (size_t) (hash >> 32) & (REPLAY_CACHE_SIZE - 1);
+}
+
+static inline bool replay_entry_live(Server *server, const ReplayEntry *entry) {
+    return entry->time_received + (uint64_t) server->parameters.retransmission_window > server->time_when_received;
+}
+
+// Returns the reply to the same request from the same client within the window, if there was one.
+static ReplayEntry *find_replay(Server *server, const struct sockaddr_in *client_address, uint32_t event_id,
+                                uint16_t ticket_count) {
+    size_t index = replay_cache_index(client_address, event_id, ticket_count);
+    for (size_t i = 0; i < REPLAY_CACHE_PROBES; i++) {
+        ReplayEntry *entry = &server->replay_cache[(index + i) & (REPLAY_CACHE_SIZE - 1)];
+        if (entry->address == client_address->sin_addr.s_addr && entry->port == client_address->sin_port
+            && entry->event_id == event_id && entry->ticket_count == ticket_count
+            && replay_entry_live(server, entry)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Takes the first free entry of the probed ones, or the oldest when all are live.
+static void remember_reply(Server *server, const struct sockaddr_in *client_address, uint32_t event_id,
+                           uint16_t ticket_count, const char *reply) {
+    size_t index = replay_cache_index(client_address, event_id, ticket_count);
+    ReplayEntry *victim = &server->replay_cache[index];
+    for (size_t i = 0; i < REPLAY_CACHE_PROBES && replay_entry_live(server, victim); i++) {
+        ReplayEntry *entry = &server->replay_cache[(index + i) & (REPLAY_CACHE_SIZE - 1)];
+        if (!replay_entry_live(server, entry) || entry->time_received < victim->time_received) {
+            victim = entry;
+        }
+    }
+
+    victim->address = client_address->sin_addr.s_addr;
+    victim->port = client_address->sin_port;
+    victim->event_id = event_id;
+    victim->ticket_count = ticket_count;
+    victim->time_received = server->time_when_received;
+    memcpy(victim->reply, reply, RESERVATION_MESSAGE_SIZE);
+}
+
+void process_reservation(const char *buffer, Server *server, struct sockaddr_in client_address) {
+    log_record(LOG_PROCESSING_RESERVATION);
+    GetReservationMessage request = decode_get_reservation(buffer);
+    uint32_t event_id = request.event_id;
+    uint16_t ticket_count = request.ticket_count;
+
+    // A retransmitted request must not hold another share of the tickets.
+    ReplayEntry *replay = NULL;
+    if (server->replay_cache != NULL
+        && (replay = find_replay(server, &client_address, event_id, ticket_count)) != NULL) {
+        char *message = next_reply_buffer(server);
+        memcpy(message, replay->reply, RESERVATION_MESSAGE_SIZE);
+        send_message(server, &client_address, message, RESERVATION_MESSAGE_SIZE);
+        metric_add(&server->metrics.reservations_replayed, 1);
+        log_record(LOG_RESERVATION_REPLAYED);
+        return;
+    }
+
+    // In a cluster the TICKETS reply must leave room for the header of a forwarded reply.
+    size_t max_reply_length = MAX_MESSAGE_LENGTH - (server->parameters.nodes > 0 ? FORWARD_HEADER_SIZE : 0);
+    if (TICKETS_MESSAGE_SIZE + (size_t) ticket_count * TICKET_CODE_LENGTH > max_reply_length) {
+        send_bad_request(event_id, server, client_address, TOO_MANY_TICKETS);
+        return;
+    }
+
+    if (event_id >= server->catalog.count || (server->parameters.nodes > 0
+        && (event_id < server->parameters.first_event_id || event_id > server->parameters.last_event_id))) {
+        send_bad_request(event_id, server, client_address, BAD_EVENT_ID);
+        return;
+    }
+
+    if (ticket_count == 0) {
+        send_bad_request(event_id, server, client_address, NO_TICKETS_REQUESTED);
+        return;
+    }
+
+    if (!take_tickets(&server->catalog, event_id, ticket_count)) {
+        send_bad_request(event_id, server, client_address, NOT_ENOUGH_TICKETS);
+        return;
+    }
+    update_events_message(server, event_id);
+
+    Reservation *reservation = add_new_reservation(server, event_id, ticket_count);
+
+    ReservationMessage reply = { .reservation_id = reservation->reservation_id, .event_id = reservation->event_id,
+                                 .ticket_count = reservation->ticket_count,
+                                 .expiration_time = reservation->expiration_time };
+    compute_cookie(reply.cookie, server->reservations.cookie_key, reservation);
+
+    char *message = next_reply_buffer(server);
+    encode_reservation(message, &reply);
+
+    // Remembered before a forwarded reply is wrapped.
+    if (server->replay_cache != NULL) {
+        remember_reply(server, &client_address, event_id, ticket_count, message);
+    }
+    send_message(server, &client_address, message, RESERVATION_MESSAGE_SIZE);
+    log_record(LOG_RESERVATION_ACCEPTED);
+}
+
+// Expires up to `limit` of the reservations that are due, returns how many it expired.
+size_t expire_reservations(Server *server, size_t limit) {
+    ReservationsContainer *reservations = &server->reservations;
+    size_t expired = 0;
+
+    for (; expired < limit && reservations->timers.slots[TIMER_EXPIRING_SLOT] != 0; expired++) {
+        Reservation *reservation = get_reservation(reservations, reservations->timers.slots[TIMER_EXPIRING_SLOT]);
+        cancel_timer(reservations, reservation);
+
+        return_tickets(&server->catalog, reservation->event_id, reservation->ticket_count);
+        update_events_message(server, reservation->event_id);
+        metric_sub(&server->metrics.reservations_pending, 1);
+        metric_sub(&server->metrics.tickets_held, reservation->ticket_count);
+        if (server->journal != NULL) {
+            append_journal_record(server->journal, (JournalRecord) { .type = JOURNAL_EXPIRE,
+                    .reservation_id = reservation->reservation_id });
+        }
+        remove_reservation(reservations, reservation);
+    }
+    return expired;
+}
+
+// Advances the timer wheel second by second up to the current time, every second costs a constant amount
+// of work plus the reservations that expire or move between the levels. The wheel stops at the second whose
+// reservations are left over when `limit` reservations have expired.
+void check_outdated_reservations(Server *server, size_t limit) {
+    ReservationsContainer *reservations = &server->reservations;
+    TimerWheel *timers = &reservations->timers;
+
+    // The server's time never goes back with the wall clock, new expiration times must not fall behind the
+    // wheel.
+    if (server->time_when_received < timers->current_time) {
+        server->time_when_received = timers->current_time;
+    }
+    if (timers->count == 0) {
+        timers->current_time = server->time_when_received;
+        return;
+    }
+
+    limit -= expire_reservations(server, limit);
+    while (limit > 0 && timers->current_time < server->time_when_received) {
+        timers->current_time++;
+        for (size_t level = TIMER_LEVELS - 1; level > 0; level--) {
+            if ((timers->current_time & ((1ULL << (TIMER_LEVEL_BITS * level)) - 1)) == 0) {
+                cascade_timers(reservations, level);
+            }
+        }
+        uint32_t reservation_id = take_timers(timers, timers->current_time & (TIMER_SLOTS - 1));
+        timers->slots[TIMER_EXPIRING_SLOT] = reservation_id;
+        if (reservation_id != 0) {
+            get_reservation(reservations, reservation_id)->timer_prev = TIMER_EXPIRING_SLOT;
+        }
+        limit -= expire_reservations(server, limit);
+    }
+}
+
+// Compared without an early exit, so the time taken does not tell how much of a guess was right.
+bool cookie_matches(ReservationsContainer *reservations, Reservation *reservation, char *cookie) {
+    char expected_cookie[COOKIE_SIZE];
+    compute_cookie(expected_cookie, reservations->cookie_key, reservation);
+    char difference = 0;
+    for (size_t i = 0; i < COOKIE_SIZE; i++) {
+        difference |= expected_cookie[i] ^ cookie[i];
+    }
+    return difference == 0;
+}
+
+Reservation *find_reservation(ReservationsContainer *reservations, uint32_t reservation_id, char *cookie) {
+    Reservation *reservation = get_reservation(reservations, reservation_id);
+    if (reservation == NULL || !cookie_matches(reservations, reservation, cookie)) {
+        return NULL;
+    }
+    return reservation;
+}
+
+void ticket_id_to_str(char *str, int64_t id) {
+    for (size_t i = 0; i < 7; i++) {
+        char temp = (char) (id % 36);
+        str[i] = temp < 10 ? (48 + temp) : (55 + temp);
+        id /= 36;
+    }
+}
+
+// Writes the codes of `count` consecutive tickets one after another. Only the first code is computed with
+// divisions, every next one is the previous code plus one, with the carry propagated over the characters.
+void encode_ticket_range(char *str, int64_t first_ticket_id, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    char code[8] = { 0 };
+    ticket_id_to_str(code, first_ticket_id);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        // The eighth byte is overwritten by the next code.
+        memcpy(str + 7 * i, code, 8);
+
+        if (code[0] != '9' && code[0] != 'Z') {
+            code[0]++;
+            continue;
+        }
+        for (size_t j = 0; j < 7; j++) {
+            if (code[j] == '9') {
+                code[j] = 'A';
+                break;
+            }
+            if (code[j] != 'Z') {
+                code[j]++;
+                break;
+            }
+            code[j] = '0';
+        }
+    }
+    memcpy(str + 7 * (count - 1), code, 7);
+}
+
+void process_tickets(const char *buffer, Server *server, struct sockaddr_in client_address) {
+    log_record(LOG_PROCESSING_TICKETS);
+    GetTicketsMessage request = decode_get_tickets(buffer);
+    uint32_t reservation_id = request.reservation_id;
+
+    Reservation *reservation = get_reservation(&server->reservations, reservation_id);
+    if (reservation == NULL) {
+        send_bad_request(reservation_id, server, client_address, UNKNOWN_RESERVATION);
+        return;
+    }
+    if (!cookie_matches(&server->reservations, reservation, request.cookie)) {
+        send_bad_request(reservation_id, server, client_address, BAD_COOKIE);
+        return;
+    }
+    if (reservation->first_ticket_id == NO_TICKETS && reservation->expiration_time < server->time_when_received) {
+        send_bad_request(reservation_id, server, client_address, RESERVATION_EXPIRED);
+        return;
+    }
+    uint16_t ticket_count = reservation->ticket_count;
+
+    if (reservation->first_ticket_id == NO_TICKETS) {
+        cancel_timer(&server->reservations, reservation);
+        reservation->first_ticket_id = server->next_ticket_id;
+        server->next_ticket_id += ticket_count;
+        metric_sub(&server->metrics.reservations_pending, 1);
+        metric_sub(&server->metrics.tickets_held, ticket_count);
+        metric_add(&server->metrics.tickets_issued, ticket_count);
+        if (server->journal != NULL) {
+            append_journal_record(server->journal, (JournalRecord) { .type = JOURNAL_ISSUE,
+                    .reservation_id = reservation_id, .value = (uint64_t) reservation->first_ticket_id });
+        }
+    }
+
+    size_t message_length = TICKETS_MESSAGE_SIZE + TICKET_CODE_LENGTH * (size_t) ticket_count;
+    char *message = next_reply_buffer(server);
+    bool cached = server->tickets_cache.entries != NULL && ticket_count >= TICKETS_CACHE_MIN_TICKETS;
+
+    if (cached) {
+        const TicketsCacheEntry *entry = find_cached_tickets(&server->tickets_cache, reservation_id);
+        if (entry != NULL) {
+            memcpy(message, entry->message, entry->length);
+            metric_add(&server->metrics.tickets_cache_hits, 1);
+            send_message(server, &client_address, message, entry->length);
+            log_record(LOG_TICKETS_SENT);
+            return;
+        }
+        metric_add(&server->metrics.tickets_cache_misses, 1);
+    }
+
+    TicketsMessage reply = { .reservation_id = reservation_id, .ticket_count = ticket_count };
+    encode_tickets(message, &reply);
+    encode_ticket_range(message + TICKETS_MESSAGE_SIZE, reservation->first_ticket_id, ticket_count);
+
+    // Cached before a forwarded reply is wrapped.
+    if (cached) {
+        cache_tickets(&server->tickets_cache, reservation_id, message, message_length);
+        metric_store(&server->metrics.tickets_cache_bytes, server->tickets_cache.bytes);
+    }
+    send_message(server, &client_address, message, message_length);
+    log_record(LOG_TICKETS_SENT);
+}
+
+void destroy_server(Server *server) {
+    free(server->reservations.slots);
+    free(server->replay_cache);
+    destroy_rate_limiter(&server->rate_limiter);
+    destroy_tickets_cache(&server->tickets_cache);
+    destroy_message_batch(&server->incoming);
+    destroy_message_batch(&server->outgoing);
+}
+
+static void handle_get_events(Server *server, const char *payload, struct sockaddr_in client_address) {
+    (void) payload;
+    send_events(server, client_address);
+}
+
+static void handle_get_reservation(Server *server, const char *payload, struct sockaddr_in client_address) {
+    process_reservation(payload, server, client_address);
+}
+
+static void handle_get_tickets(Server *server, const char *payload, struct sockaddr_in client_address) {
+    process_tickets(payload, server, client_address);
+}
+
+static void handle_get_events_page(Server *server, const char *payload, struct sockaddr_in client_address) {
+    send_events_page(server, decode_get_events_page(payload).event_id, client_address);
+}
+
+static void handle_malformed(Server *server, const char *payload, struct sockaddr_in client_address) {
+    (void) server;
+    (void) payload;
+    (void) client_address;
+    log_record(LOG_IMPROPER_MESSAGE);
+}
+
+// Handlers by the kind `request_kind_of` finds, called with the bytes after the type byte.
+static void (*const request_handlers[REQUEST_KINDS])(Server *, const char *, struct sockaddr_in) = {
+    [REQUEST_GET_EVENTS] = handle_get_events,
+    [REQUEST_GET_RESERVATION] = handle_get_reservation,
+    [REQUEST_GET_TICKETS] = handle_get_tickets,
+    [REQUEST_GET_EVENTS_PAGE] = handle_get_events_page,
+    [REQUEST_MALFORMED] = handle_malformed,
+};
+
+// Processes the request wrapped by a router as if it came from the client, the reply goes back to the router.
+static void process_forwarded_message(Server *server, const char *buffer, size_t read_length,
+                                      struct sockaddr_in router_address) {
+    struct sockaddr_in client_address = { .sin_family = AF_INET };
+    memcpy(&client_address.sin_addr.s_addr, buffer + 1, 4);
+    memcpy(&client_address.sin_port, buffer + 5, 2);
+
+    server->forward_address = &router_address;
+    process_message(server, buffer + FORWARD_HEADER_SIZE, read_length - FORWARD_HEADER_SIZE, client_address);
+    server->forward_address = NULL;
+}
+
+void process_message(Server *server, const char *buffer, size_t read_length, struct sockaddr_in client_address) {
+    uint64_t start_ns = monotonic_ns();
+    // A forwarded request keeps the clocks and the capture of the datagram that carried it. The capture takes
+    // every datagram, also those the rate limiter drops, so that a replay makes the same decisions.
+    if (server->forward_address == NULL) {
+        if (server->replay != NULL) {
+            server->time_ns_when_received = server->replay->time_ns;
+            server->time_when_received = server->replay->time;
+        }
+        else {
+            server->time_ns_when_received = start_ns;
+            if (server->trace != NULL) {
+                server->time_when_received = time(NULL);
+            }
+        }
+        if (server->trace != NULL) {
+            append_trace_record(server->trace, server->time_ns_when_received, server->time_when_received, buffer,
+                                read_length, &client_address);
+        }
+    }
+
+    if (read_length > FORWARD_HEADER_SIZE && buffer[0] == FORWARD && server->parameters.nodes > 0
+        && server->forward_address == NULL) {
+        process_forwarded_message(server, buffer, read_length, client_address);
+        return;
+    }
+
+    RequestKind kind = request_kind_of(buffer, read_length);
+
+    // Requests over the budget of their source are dropped before they cost anything else, the monotonic clock
+    // is all the limiter needs, the wall clock is read only for the requests that pass.
+    if (server->rate_limiter.buckets != NULL
+        && !rate_limit_allows(&server->rate_limiter, client_address.sin_addr.s_addr, kind,
+                              server->time_ns_when_received)) {
+        metric_add(&server->metrics.rate_limited[kind], 1);
+        return;
+    }
+    if (server->replay == NULL && server->trace == NULL) {
+        server->time_when_received = time(NULL);
+    }
+
+    log_record(LOG_RECEIVED, read_length, client_address.sin_addr.s_addr, ntohs(client_address.sin_port),
+               server->time_when_received);
+
+    check_outdated_reservations(server, MAX_EXPIRATIONS_PER_REQUEST);
+
+    request_handlers[kind](server, buffer + 1, client_address);
+
+    record_request(&server->metrics, kind, monotonic_ns() - start_ns);
+}
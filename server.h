@@ -0,0 +1,304 @@
+#ifndef _SERVER_
+#define _SERVER_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#include "catalog.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "rate_limit.h"
+#include "tickets_cache.h"
+#include "log.h"
+
+#define MAX_NODES 64
+
+// Every SipHash output gives this many cookie characters, 94^8 < 2^64.
+#define COOKIE_CHARACTERS_PER_HASH 8
+#define NO_TICKETS (-1)
+// Largest catalog, event ids and positions in the pages are 32-bit.
+#define MAX_EVENTS (1 << 22)
+#define INITIAL_RESERVATIONS_CAPACITY 1024
+// Three levels of 256 one second, 256 second and 65536 second slots cover timeouts of up to 2^24 seconds.
+#define TIMER_LEVEL_BITS 8
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_LEVELS 3
+#define TIMER_WHEEL_SIZE (TIMER_LEVELS * TIMER_SLOTS)
+// Slot after the wheel, holding the reservations that are due but not expired yet.
+#define TIMER_EXPIRING_SLOT TIMER_WHEEL_SIZE
+// Most reservations a request expires, the rest wait for the next check, so a backlog after a stall does not
+// hold up a request for long. Housekeeping and recovery expire all of them.
+#define MAX_EXPIRATIONS_PER_REQUEST 1024
+#define ALL_EXPIRATIONS SIZE_MAX
+#define FIRST_RESERVATION_ID 1000000
+// Retransmission cache of RESERVATION replies, a request is looked for in this many consecutive entries.
+#define REPLAY_CACHE_SIZE 8192
+#define REPLAY_CACHE_PROBES 4
+// Events a worker remembers changing between two checks for a reloaded catalog, beyond them it refreshes the
+// whole catalog when it adopts one.
+#define CHANGED_EVENTS_CAPACITY 4096
+// Number of distinct 7 character ticket codes, split evenly between the workers.
+#define TICKET_ID_SPACE 78364164096LL
+
+#define ENSURE(x)                                                         \
+    do {                                                                  \
+        bool result = (x);                                                \
+        if (!result) {                                                    \
+            fprintf(stderr, "Error: %s was false in %s at %s:%d\n",       \
+                #x, __func__, __FILE__, __LINE__);                        \
+            exit(EXIT_FAILURE);                                           \
+        }                                                                 \
+    } while (0)
+
+#define CHECK(x)                                                          \
+    do {                                                                  \
+        int err = (x);                                                    \
+        if (err != 0) {                                                   \
+            fprintf(stderr, "Error: %s returned %d in %s at %s:%d\n%s\n", \
+                #x, err, __func__, __FILE__, __LINE__, strerror(err));    \
+            exit(EXIT_FAILURE);                                           \
+        }                                                                 \
+    } while (0)
+
+#define PRINT_ERRNO()                                                  \
+    do {                                                               \
+        if (errno != 0) {                                              \
+            fprintf(stderr, "Error: errno %d in %s at %s:%d\n%s\n",    \
+              errno, __func__, __FILE__, __LINE__, strerror(errno));   \
+            exit(EXIT_FAILURE);                                        \
+        }                                                              \
+    } while (0)
+
+#define CHECK_ERRNO(x)                                                             \
+    do {                                                                           \
+        errno = 0;                                                                 \
+        (void) (x);                                                                \
+        PRINT_ERRNO();                                                             \
+    } while (0)
+
+typedef struct Parameters {
+    FILE *file_ptr;
+    // Read again when the catalog is reloaded.
+    char *events_path;
+    int port;
+    // Port of the metrics endpoint on the loopback interface, -1 when it is disabled.
+    int admin_port;
+    int time_limit;
+    size_t batch_size;
+    size_t workers;
+    bool use_uring;
+    // Directory of the journals, NULL when the state is kept only in memory.
+    char *journal_directory;
+    // How long a batch waits for more datagrams before its group commit, in microseconds.
+    long commit_window;
+    // Seconds between snapshots of the state, 0 when no snapshots are taken.
+    long snapshot_interval;
+    // Seconds during which a repeated GET_RESERVATION gets the original reply, 0 when it is not cached.
+    long retransmission_window;
+    // Requests of each type a source address may send to a worker.
+    RateBudget rate_limits[RATE_LIMITED_KINDS];
+    LogLevel log_level;
+    // Bytes of TICKETS replies each worker keeps for repeated GET_TICKETS, 0 when they are not cached.
+    size_t tickets_cache_bytes;
+    // Position of the process in a cluster, `nodes` is 0 when it runs alone. A node only reserves tickets of
+    // the events from `first_event_id` to `last_event_id`.
+    size_t node;
+    size_t nodes;
+    uint32_t first_event_id;
+    uint32_t last_event_id;
+    // Where to write the compiled catalog, the server exits after writing it.
+    char *catalog_path;
+    // Directory of the traces of received datagrams, NULL when they are not captured.
+    char *trace_directory;
+    // Trace to replay instead of serving, the server exits after replaying it. Without `replay_fast` the
+    // datagrams are replayed at the speed they were received.
+    char *replay_path;
+    bool replay_fast;
+    // Microseconds a receive polls the device queue for, 0 when the workers sleep until datagrams arrive.
+    long busy_poll;
+    // Worker `i` runs only on CPU `first_cpu + i`, -1 when the workers are not pinned.
+    long first_cpu;
+} Parameters;
+
+// Datagrams received with a single recvmmsg or queued for a single sendmmsg.
+typedef struct MessageBatch {
+    struct mmsghdr *headers;
+    struct iovec *iovecs;
+    struct sockaddr_in *addresses;
+    char *buffers;
+    size_t buffer_size;
+    size_t capacity;
+    size_t count;
+} MessageBatch;
+
+typedef struct __attribute__((__packed__)) Reservation {
+    uint32_t reservation_id;
+    uint32_t event_id;
+    uint16_t ticket_count;
+    uint64_t expiration_time;
+    int64_t first_ticket_id;
+    // Neighbours on the timer wheel list, by reservation id. The first reservation on a list stores the index
+    // of its wheel slot as `timer_prev`, these never collide with reservation ids.
+    uint32_t timer_prev;
+    uint32_t timer_next;
+} Reservation;
+
+// Hierarchical timer wheel of reservations waiting for their tickets to be picked up. Each slot of the
+// lowest level holds reservations expiring at one second, slots of the higher levels are moved to the lower
+// levels when the current time reaches them.
+typedef struct TimerWheel {
+    uint32_t slots[TIMER_WHEEL_SIZE + 1];
+    uint64_t current_time;
+    size_t count;
+} TimerWheel;
+
+// Ring of reservations indexed by the sequence number encoded in the reservation id. The id of the
+// reservation stored in a slot tells whether it is the one we look for, empty slots have id 0. A slot still
+// held by a reservation whose tickets were picked up is skipped together with its sequence number.
+typedef struct ReservationsContainer {
+    Reservation *slots;
+    size_t capacity;
+    size_t count;
+    uint64_t next_sequence;
+    uint32_t first_id;
+    uint32_t id_step;
+    TimerWheel timers;
+    uint64_t cookie_key[2];
+} ReservationsContainer;
+
+// RESERVATION reply sent to a client, replayed when the same client sends the same GET_RESERVATION again
+// within the retransmission window. Entries received before the window are free.
+typedef struct ReplayEntry {
+    uint32_t address;
+    uint16_t port;
+    uint16_t ticket_count;
+    uint32_t event_id;
+    uint64_t time_received;
+    char reply[RESERVATION_MESSAGE_SIZE];
+} ReplayEntry;
+
+// Each node of a cluster hands out reservation ids from its own range of this size, the router finds the
+// node of a GET_TICKETS by the range of its reservation id.
+static inline uint32_t node_reservation_ids(size_t nodes) {
+    return (uint32_t) ((UINT32_MAX - FIRST_RESERVATION_ID) / (nodes == 0 ? 1 : nodes));
+}
+
+// First reservation id of the node, worker `i` of the node hands out the ids `i`, `i + workers`, ... after it.
+static inline uint32_t node_first_reservation_id(size_t node, size_t nodes) {
+    return FIRST_RESERVATION_ID + (uint32_t) node * node_reservation_ids(nodes);
+}
+
+static inline uint32_t reservation_id_of(ReservationsContainer *reservations, uint64_t sequence) {
+    return reservations->first_id + (uint32_t) sequence * reservations->id_step;
+}
+
+static inline Reservation *reservation_slot(ReservationsContainer *reservations, uint64_t sequence) {
+    return &reservations->slots[sequence & (reservations->capacity - 1)];
+}
+
+typedef struct Server {
+    Parameters parameters;
+    size_t worker_id;
+    int socket_fd;
+    Catalog catalog;
+    ReservationsContainer reservations;
+    int64_t next_ticket_id;
+    uint64_t time_when_received;
+    // Monotonic clock at the same moment, in nanoseconds.
+    uint64_t time_ns_when_received;
+    MessageBatch incoming;
+    MessageBatch outgoing;
+    // Open-addressed, REPLAY_CACHE_SIZE entries, NULL when the retransmission window is 0.
+    ReplayEntry *replay_cache;
+    // Without buckets when no type is rate limited.
+    RateLimiter rate_limiter;
+    // Without entries when the TICKETS replies are not cached.
+    TicketsCache tickets_cache;
+    // Router of the request that is processed, set only while a forwarded request is processed.
+    const struct sockaddr_in *forward_address;
+    Metrics metrics;
+    // Set when the worker uses the io_uring backend instead of recvmmsg and sendmmsg.
+    struct Uring *uring;
+    // Set when changes of the state are journaled.
+    struct Journal *journal;
+    // Set when the received datagrams are captured.
+    struct Trace *trace;
+    // Set when a trace is replayed, its clocks replace the real ones and the replies are digested, not sent.
+    struct TraceReplay *replay;
+    // Process writing the current snapshot, 0 when none is being written.
+    pid_t snapshot_pid;
+    uint64_t next_snapshot_time;
+    EventsMessage *events_message;
+    // Queued replies point to the shared EVENTS message, so it must not change before they are sent.
+    bool events_message_queued;
+    // Publishes reloaded catalogs, NULL when the catalog never changes.
+    struct Reloader *reloader;
+    // Number of the catalog version the worker uses.
+    _Atomic uint64_t catalog_version;
+    // Events whose counts the worker wrote since it last looked for a reloaded catalog, only with a reloader.
+    // The count goes past the capacity when some were not remembered.
+    uint32_t changed_events[CHANGED_EVENTS_CAPACITY];
+    size_t changed_event_count;
+} Server;
+
+void fatal(const char *message);
+void *safe_malloc(size_t size);
+void *safe_realloc(void *ptr, size_t size);
+
+uint64_t siphash24(const uint64_t key[2], const uint64_t words[3]);
+
+bool take_tickets(Catalog *catalog, uint32_t event_id, uint16_t ticket_count);
+void return_tickets(Catalog *catalog, uint32_t event_id, uint16_t ticket_count);
+
+MessageBatch new_message_batch(size_t capacity, size_t buffer_size);
+void destroy_message_batch(MessageBatch *batch);
+
+ReservationsContainer new_reservations_container(uint32_t first_id, uint32_t id_step, uint64_t current_time,
+                                                 const uint64_t cookie_key[2]);
+Reservation *get_reservation(ReservationsContainer *reservations, uint32_t reservation_id);
+void grow_reservations_container(ReservationsContainer *reservations);
+Reservation *insert_reservation(ReservationsContainer *reservations);
+Reservation *insert_reservation_with_id(ReservationsContainer *reservations, uint32_t reservation_id);
+void remove_reservation(ReservationsContainer *reservations, Reservation *reservation);
+void add_timer(ReservationsContainer *reservations, Reservation *reservation);
+void cancel_timer(ReservationsContainer *reservations, Reservation *reservation);
+uint32_t take_timers(TimerWheel *timers, size_t index);
+void cascade_timers(ReservationsContainer *reservations, size_t level);
+
+Server initialize_server(Parameters parameters, Catalog catalog, EventsMessage *events_message,
+                         const uint64_t cookie_key[2], size_t worker_id, int socket_fd);
+void destroy_server(Server *server);
+
+char *next_reply_buffer(Server *server);
+void send_message(Server *server, const struct sockaddr_in *client_address, const char *message, size_t length);
+void flush_messages(Server *server);
+void write_event_ticket_count(EventsMessage *events_message, const Catalog *catalog, uint32_t event_id);
+void update_events_message(Server *server, uint32_t event_id);
+void send_events(Server *server, struct sockaddr_in client_address);
+void send_events_page(Server *server, uint32_t event_id, struct sockaddr_in client_address);
+void send_bad_request(uint32_t id, Server *server, struct sockaddr_in client_address, BadRequestReason reason);
+
+void compute_cookie(char *cookie, const uint64_t key[2], const Reservation *reservation);
+Reservation *add_new_reservation(Server *server, uint32_t event_id, uint16_t ticket_count);
+void process_reservation(const char *buffer, Server *server, struct sockaddr_in client_address);
+size_t expire_reservations(Server *server, size_t limit);
+void check_outdated_reservations(Server *server, size_t limit);
+bool cookie_matches(ReservationsContainer *reservations, Reservation *reservation, char *cookie);
+Reservation *find_reservation(ReservationsContainer *reservations, uint32_t reservation_id, char *cookie);
+void ticket_id_to_str(char *str, int64_t id);
+void encode_ticket_range(char *str, int64_t first_ticket_id, size_t count);
+
+void process_tickets(const char *buffer, Server *server, struct sockaddr_in client_address);
+void process_message(Server *server, const char *buffer, size_t read_length, struct sockaddr_in client_address);
+
+#endif
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "snapshot.h"
+#include "journal.h"
+
+static void snapshot_path(char *path, const char *directory, size_t worker_id, const char *suffix) {
+    int length = snprintf(path, PATH_MAX, "%s/snapshot.%zu%s", directory, worker_id, suffix);
+    if (length < 0 || length >= PATH_MAX) {
+        fatal("snapshot path is too long.");
+    }
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const char *bytes = data;
+    while (size > 0) {
+        ssize_t result = write(fd, bytes, size);
+        if (result < 0 && errno != EINTR) {
+            return false;
+        }
+        bytes += result > 0 ? result : 0;
+        size -= result > 0 ? (size_t) result : 0;
+    }
+    return true;
+}
+
+// Runs in the forked child, which must not exit through `fatal` and flush the stdio buffers of the parent.
+// The snapshot replaces the previous one only once it is durable.
+static bool write_snapshot(Server *server, const SnapshotHeader *header) {
+    char *directory = server->parameters.journal_directory;
+    char path[PATH_MAX];
+    char temporary_path[PATH_MAX];
+    snapshot_path(path, directory, server->worker_id, "");
+    snapshot_path(temporary_path, directory, server->worker_id, ".tmp");
+
+    int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    ReservationsContainer *reservations = &server->reservations;
+    bool written = write_all(fd, header, sizeof(SnapshotHeader))
+                   && write_all(fd, reservations->slots, reservations->capacity * sizeof(Reservation))
+                   && fdatasync(fd) == 0;
+    if (close(fd) != 0 || !written || rename(temporary_path, path) != 0) {
+        return false;
+    }
+
+    int directory_fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (directory_fd < 0) {
+        return false;
+    }
+    bool synced = fsync(directory_fd) == 0;
+    return close(directory_fd) == 0 && synced;
+}
+
+// Called between batches, when every change of the state is committed to the journal. The child gets a
+// copy-on-write view of the state at this point and writes it while the worker goes on, so the worker only
+// pays for the fork itself.
+void take_snapshot(Server *server) {
+    if (server->snapshot_pid > 0) {
+        int status;
+        pid_t pid = waitpid(server->snapshot_pid, &status, WNOHANG);
+        if (pid == 0) {
+            return;
+        }
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Snapshot of worker %zu failed.\n", server->worker_id);
+        }
+        else {
+            metric_add(&server->metrics.snapshots, 1);
+        }
+        server->snapshot_pid = 0;
+    }
+    if (server->time_when_received < server->next_snapshot_time) {
+        return;
+    }
+    server->next_snapshot_time = server->time_when_received + server->parameters.snapshot_interval;
+
+    ReservationsContainer *reservations = &server->reservations;
+    SnapshotHeader header = { .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION,
+                              .worker_id = server->worker_id, .workers = server->parameters.workers,
+                              .event_count = server->catalog.count, .journal_offset = server->journal->size,
+                              .capacity = reservations->capacity, .count = reservations->count,
+                              .next_sequence = reservations->next_sequence,
+                              .next_ticket_id = server->next_ticket_id, .timers = reservations->timers };
+
+    uint64_t start_ns = monotonic_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(write_snapshot(server, &header) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    metric_add(&server->metrics.syscalls, 1);
+    metric_add(&server->metrics.snapshot_pause_ns, monotonic_ns() - start_ns);
+    if (pid < 0) {
+        fprintf(stderr, "Snapshot of worker %zu failed: %s\n", server->worker_id, strerror(errno));
+        return;
+    }
+    server->snapshot_pid = pid;
+}
+
+// Restores the state of the worker from its latest snapshot, returns the journal offset to replay from.
+uint64_t load_snapshot(Server *server) {
+    char path[PATH_MAX];
+    snapshot_path(path, server->parameters.journal_directory, server->worker_id, "");
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return sizeof(JournalHeader);
+        }
+        PRINT_ERRNO();
+    }
+    struct stat file_stat;
+    CHECK_ERRNO(fstat(fd, &file_stat));
+    size_t size = (size_t) file_stat.st_size;
+    if (size < sizeof(SnapshotHeader)) {
+        fatal("snapshot is corrupted.");
+    }
+    char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ENSURE(mapping != MAP_FAILED);
+    CHECK_ERRNO(close(fd));
+
+    SnapshotHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION
+        || header.worker_id != server->worker_id || header.capacity == 0
+        || (header.capacity & (header.capacity - 1)) != 0
+        || header.capacity > (size - sizeof(header)) / sizeof(Reservation)
+        || size != sizeof(header) + header.capacity * sizeof(Reservation)) {
+        fatal("snapshot is corrupted.");
+    }
+    if (header.workers != server->parameters.workers || header.event_count > server->catalog.count) {
+        fatal("snapshot was written for a different number of workers or for more events.");
+    }
+
+    ReservationsContainer *reservations = &server->reservations;
+    free(reservations->slots);
+    reservations->capacity = header.capacity;
+    reservations->slots = safe_malloc(header.capacity * sizeof(Reservation));
+    memcpy(reservations->slots, mapping + sizeof(header), header.capacity * sizeof(Reservation));
+    CHECK_ERRNO(munmap(mapping, size));
+    reservations->count = header.count;
+    reservations->next_sequence = header.next_sequence;
+    reservations->timers = header.timers;
+    server->next_ticket_id = header.next_ticket_id;
+
+    // Other workers restore their shares separately, so the counts may pass through negative values.
+    for (size_t i = 0; i < reservations->capacity; i++) {
+        Reservation *reservation = &reservations->slots[i];
+        if (reservation->reservation_id == 0) {
+            continue;
+        }
+        if (reservation->event_id >= server->catalog.count) {
+            fatal("snapshot is corrupted.");
+        }
+        atomic_fetch_sub_explicit(&server->catalog.tickets[reservation->event_id],
+                                  reservation->ticket_count, memory_order_relaxed);
+        if (reservation->first_ticket_id == NO_TICKETS) {
+            metric_add(&server->metrics.reservations_pending, 1);
+            metric_add(&server->metrics.tickets_held, reservation->ticket_count);
+        }
+        else {
+            metric_add(&server->metrics.tickets_issued, reservation->ticket_count);
+        }
+    }
+
+    return header.journal_offset;
+}
@@ -0,0 +1,31 @@
+#ifndef _SNAPSHOT_
+#define _SNAPSHOT_
+
+#include "server.h"
+
+// "TICKSNP1" read as a little endian integer.
+#define SNAPSHOT_MAGIC 0x31504e534b434954ULL
+#define SNAPSHOT_VERSION 2
+
+// Point-in-time state of one worker, followed by the slots of its reservations container exactly as they
+// are in memory. Event ticket counts are not stored, the worker's share of them follows from its
+// reservations. Integers are in the byte order of the machine that wrote it.
+typedef struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t worker_id;
+    uint64_t workers;
+    uint64_t event_count;
+    // Size of the journal when the snapshot was taken, replay continues from there.
+    uint64_t journal_offset;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t next_sequence;
+    int64_t next_ticket_id;
+    TimerWheel timers;
+} SnapshotHeader;
+
+uint64_t load_snapshot(Server *server);
+void take_snapshot(Server *server);
+
+#endif // _SNAPSHOT_
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Reservations of a cluster whose nodes run several workers must be picked up through the router and directly
+# from their node, whichever worker the GET_TICKETS reaches first.
+# Usage: cluster_steering.py <ticket_server> <ticket_router>
+import os, socket, struct, subprocess, sys, tempfile, time
+
+server, router = sys.argv[1], sys.argv[2]
+nodes, workers, reservations = 3, 4, 60
+base = 40000 + os.getpid() % 2000 * 8
+ranges = ['0-99', '100-199', '200-']
+
+events = tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False)
+for i in range(300):
+    events.write('event %d\n1000\n' % i)
+events.close()
+
+processes = [subprocess.Popen([server, '-f', events.name, '-p', str(base + 1 + k), '-w', str(workers), '-r', '0',
+                               '-n', '%d/%d' % (k, nodes), '-e', ranges[k]]) for k in range(nodes)]
+processes.append(subprocess.Popen([router, '-p', str(base), '-i', '50']
+                                  + sum((['-n', '127.0.0.1:%d:%s' % (base + 1 + k, ranges[k])]
+                                         for k in range(nodes)), [])))
+time.sleep(0.5)
+
+def request(message, port):
+    # A new source port every time, so the requests are spread over the workers.
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as client:
+        client.settimeout(1)
+        client.sendto(message, ('127.0.0.1', port))
+        return client.recv(70000)
+
+failures = 0
+try:
+    for i in range(reservations):
+        event_id = i * 5 % 300
+        node = event_id // 100
+        reservation = request(b'\x03' + struct.pack('!IH', event_id, 1), base)
+        assert reservation[0] == 4, reservation
+        pick_up = b'\x05' + reservation[1:5] + reservation[11:59]
+        # The retransmission of a pick up must get the same tickets, through the router and from the node.
+        for port in (base, base + 1 + node):
+            tickets = request(pick_up, port)
+            if tickets[0] != 6:
+                failures += 1
+                print('reservation %d of node %d not found via port %d' % (struct.unpack('!I', reservation[1:5])[0],
+                                                                          node, port))
+finally:
+    for process in processes:
+        process.kill()
+    os.unlink(events.name)
+
+print('%d reservations, %d pick ups failed' % (reservations, failures))
+sys.exit(1 if failures else 0)
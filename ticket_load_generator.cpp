@@ -0,0 +1,583 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace {
+
+constexpr uint8_t GET_EVENTS = 1;
+constexpr uint8_t EVENTS = 2;
+constexpr uint8_t GET_RESERVATION = 3;
+constexpr uint8_t RESERVATION = 4;
+constexpr uint8_t GET_TICKETS = 5;
+constexpr uint8_t TICKETS = 6;
+constexpr uint8_t GET_EVENTS_PAGE = 7;
+constexpr uint8_t EVENTS_PAGE = 8;
+constexpr uint8_t BAD_REQUEST = 255;
+constexpr uint32_t NO_MORE_EVENTS = UINT32_MAX;
+constexpr ssize_t EVENTS_PAGE_HEADER_SIZE = 5;
+
+constexpr size_t COOKIE_SIZE = 48;
+constexpr size_t MAX_MESSAGE_LENGTH = 65507;
+constexpr uint32_t FIRST_RESERVATION_ID = 1000000;
+constexpr size_t MAX_RESERVATION_POOL = 1 << 16;
+
+enum RequestType { EVENTS_REQUEST, RESERVATION_REQUEST, TICKETS_REQUEST, REQUEST_TYPES };
+const char *REQUEST_NAMES[REQUEST_TYPES] = { "GET_EVENTS", "GET_RESERVATION", "GET_TICKETS" };
+
+[[noreturn]] void fatal(const string &message) {
+    fprintf(stderr, "Error: %s\n", message.c_str());
+    exit(1);
+}
+
+[[noreturn]] void fatal_usage(const string &message) {
+    fprintf(stderr, "Error: %s\nUsage: [-a <address>] [-p <port>] [-r <requests per second>] [-d <seconds>] "
+                    "[-s <sockets>] [-j <threads>] [-m <events>:<reservations>:<tickets>] [-n <tickets>] "
+                    "[-w <drain seconds>]\n"
+                    "       -g <events file to generate> [-e <events>] [-c <tickets per event>]\n",
+            message.c_str());
+    exit(1);
+}
+
+long parse_number(const char *text, long min, long max, const string &what) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (*end != '\0' || value < min || value > max) {
+        fatal_usage("parameter value is not a proper " + what + ".");
+    }
+    return value;
+}
+
+struct Parameters {
+    sockaddr_in server_address{};
+    double rate = 1000;
+    double duration = 10;
+    double drain = 1;
+    size_t sockets = 16;
+    size_t threads = 1;
+    array<unsigned, REQUEST_TYPES> mix = { 1, 1, 1 };
+    uint16_t tickets_per_reservation = 1;
+    string generate_path;
+    size_t generate_events = 1000;
+    uint16_t generate_tickets = 65535;
+};
+
+Parameters parse_args(int argc, char *argv[]) {
+    Parameters parameters;
+    string address = "127.0.0.1";
+    uint16_t port = 2022;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:r:d:s:j:m:n:w:g:e:c:")) != -1) {
+        switch (opt) {
+            case 'a':
+                address = optarg;
+                break;
+            case 'p':
+                port = (uint16_t) parse_number(optarg, 0, 65535, "port");
+                break;
+            case 'r':
+                parameters.rate = (double) parse_number(optarg, 1, 100000000, "request rate");
+                break;
+            case 'd':
+                parameters.duration = (double) parse_number(optarg, 1, 86400, "duration");
+                break;
+            case 's':
+                parameters.sockets = (size_t) parse_number(optarg, 1, 65536, "number of sockets");
+                break;
+            case 'j':
+                parameters.threads = (size_t) parse_number(optarg, 1, 256, "number of threads");
+                break;
+            case 'm':
+                if (sscanf(optarg, "%u:%u:%u", &parameters.mix[0], &parameters.mix[1], &parameters.mix[2]) != 3
+                    || parameters.mix[0] + parameters.mix[1] + parameters.mix[2] == 0) {
+                    fatal_usage("parameter value is not a proper request mix.");
+                }
+                break;
+            case 'n':
+                parameters.tickets_per_reservation = (uint16_t) parse_number(optarg, 1, 65535, "ticket count");
+                break;
+            case 'w':
+                parameters.drain = (double) parse_number(optarg, 0, 3600, "drain time");
+                break;
+            case 'g':
+                parameters.generate_path = optarg;
+                break;
+            case 'e':
+                parameters.generate_events = (size_t) parse_number(optarg, 1, 1000000, "number of events");
+                break;
+            case 'c':
+                parameters.generate_tickets = (uint16_t) parse_number(optarg, 0, 65535, "ticket count");
+                break;
+            default:
+                fatal_usage("improper usage.");
+        }
+    }
+    if (optind < argc) {
+        fatal_usage("improper usage.");
+    }
+    if (parameters.sockets < parameters.threads) {
+        fatal_usage("every thread needs at least one socket.");
+    }
+
+    parameters.server_address.sin_family = AF_INET;
+    parameters.server_address.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &parameters.server_address.sin_addr) != 1) {
+        fatal_usage("parameter value is not a proper IPv4 address.");
+    }
+    return parameters;
+}
+
+void generate_events_file(const Parameters &parameters) {
+    ofstream file(parameters.generate_path);
+    if (!file) {
+        fatal("opening of the events file failed.");
+    }
+    for (size_t i = 0; i < parameters.generate_events; i++) {
+        file << "load test event " << i << "\n" << parameters.generate_tickets << "\n";
+    }
+    if (!file.flush()) {
+        fatal("writing of the events file failed.");
+    }
+}
+
+// Log-linear histogram of latencies in nanoseconds: 2^SUB_BITS buckets for every power of two.
+class Histogram {
+    static constexpr size_t SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr size_t BUCKETS = 64 * SUB_BUCKETS;
+
+    array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+
+    static size_t bucket_of(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        size_t magnitude = 63 - __builtin_clzll(value);
+        size_t sub = (value >> (magnitude - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (magnitude - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t upper_bound_of(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        size_t magnitude = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (magnitude - SUB_BITS)) - 1;
+    }
+
+public:
+    void record(uint64_t value) {
+        counts[bucket_of(value)]++;
+        total++;
+    }
+
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t percentile(double fraction) const {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) ceil(fraction * (double) total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= max<uint64_t>(rank, 1)) {
+                return upper_bound_of(i);
+            }
+        }
+        return upper_bound_of(BUCKETS - 1);
+    }
+};
+
+struct Statistics {
+    array<uint64_t, REQUEST_TYPES> sent{};
+    array<uint64_t, REQUEST_TYPES> bad_requests{};
+    array<Histogram, REQUEST_TYPES> latencies;
+
+    void merge(const Statistics &other) {
+        for (size_t i = 0; i < REQUEST_TYPES; i++) {
+            sent[i] += other.sent[i];
+            bad_requests[i] += other.bad_requests[i];
+            latencies[i].merge(other.latencies[i]);
+        }
+    }
+};
+
+struct ReservationTicket {
+    uint32_t reservation_id;
+    char cookie[COOKIE_SIZE];
+};
+
+// Replies carry no request identifier, so a reply is matched with the oldest unanswered request of the same
+// socket, type and event_id or reservation_id.
+uint64_t pending_key(RequestType type, uint32_t id) {
+    return (uint64_t) type << 32 | id;
+}
+
+class LoadThread {
+    const Parameters &parameters;
+    double rate;
+    uint32_t event_count;
+    vector<int> sockets;
+    vector<map<uint64_t, deque<Clock::time_point>>> pending;
+    vector<ReservationTicket> reservation_pool;
+    mt19937_64 random;
+    discrete_distribution<int> mix;
+    int epoll_fd;
+
+public:
+    Statistics statistics;
+
+    LoadThread(const Parameters &parameters, size_t socket_count, double rate, uint32_t event_count,
+               uint64_t seed)
+            : parameters(parameters), rate(rate), event_count(event_count), pending(socket_count),
+              random(seed), mix(parameters.mix.begin(), parameters.mix.end()) {
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0) {
+            fatal("epoll_create1 failed.");
+        }
+        for (size_t i = 0; i < socket_count; i++) {
+            int socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+            int buffer_size = 1 << 22;
+            setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+            if (socket_fd < 0 || connect(socket_fd, (const sockaddr *) &parameters.server_address,
+                                         sizeof(parameters.server_address)) != 0) {
+                fatal("creating of a client socket failed.");
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = i;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event) != 0) {
+                fatal("epoll_ctl failed.");
+            }
+            sockets.push_back(socket_fd);
+        }
+    }
+
+    ~LoadThread() {
+        for (int socket_fd : sockets) {
+            close(socket_fd);
+        }
+        close(epoll_fd);
+    }
+
+    void run(Clock::time_point start, Clock::time_point end, Clock::time_point drain_end) {
+        auto interval = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / rate));
+        Clock::time_point next_send = start;
+        size_t next_socket = 0;
+
+        while (true) {
+            Clock::time_point now = Clock::now();
+            // Requests go out on schedule no matter how many replies are missing, latency is measured from
+            // the scheduled time, so a stalled server is not hidden by a stalled client.
+            while (next_send <= now && next_send < end) {
+                send_request(next_socket, next_send);
+                next_socket = (next_socket + 1) % sockets.size();
+                next_send += interval;
+            }
+            if (now >= drain_end || (now >= end && pending_count() == 0)) {
+                break;
+            }
+
+            Clock::time_point wake_up = next_send < end ? next_send : drain_end;
+            auto timeout = chrono::duration_cast<chrono::milliseconds>(wake_up - now).count();
+            epoll_event events[64];
+            int ready = epoll_wait(epoll_fd, events, 64, (int) max<long long>(timeout, 0));
+            for (int i = 0; i < ready; i++) {
+                receive_replies(events[i].data.u64);
+            }
+        }
+    }
+
+private:
+    size_t pending_count() const {
+        size_t count = 0;
+        for (const auto &socket_pending : pending) {
+            for (const auto &entry : socket_pending) {
+                count += entry.second.size();
+            }
+        }
+        return count;
+    }
+
+    void send_request(size_t socket_index, Clock::time_point scheduled) {
+        auto type = (RequestType) mix(random);
+        if (type == TICKETS_REQUEST && reservation_pool.empty()) {
+            type = RESERVATION_REQUEST;
+        }
+
+        char message[1 + 4 + COOKIE_SIZE];
+        size_t length;
+        uint32_t id = 0;
+
+        if (type == EVENTS_REQUEST) {
+            message[0] = GET_EVENTS;
+            length = 1;
+        }
+        else if (type == RESERVATION_REQUEST) {
+            id = (uint32_t) (random() % event_count);
+            uint32_t event_id = htonl(id);
+            uint16_t ticket_count = htons(parameters.tickets_per_reservation);
+            message[0] = GET_RESERVATION;
+            memcpy(message + 1, &event_id, 4);
+            memcpy(message + 5, &ticket_count, 2);
+            length = 7;
+        }
+        else {
+            const ReservationTicket &reservation = reservation_pool[random() % reservation_pool.size()];
+            id = reservation.reservation_id;
+            uint32_t reservation_id = htonl(id);
+            message[0] = GET_TICKETS;
+            memcpy(message + 1, &reservation_id, 4);
+            memcpy(message + 5, reservation.cookie, COOKIE_SIZE);
+            length = 1 + 4 + COOKIE_SIZE;
+        }
+
+        statistics.sent[type]++;
+        if (send(sockets[socket_index], message, length, 0) == (ssize_t) length) {
+            pending[socket_index][pending_key(type, id)].push_back(scheduled);
+        }
+    }
+
+    void receive_replies(size_t socket_index) {
+        static thread_local char buffer[MAX_MESSAGE_LENGTH];
+
+        while (true) {
+            ssize_t length = recv(sockets[socket_index], buffer, sizeof(buffer), 0);
+            if (length <= 0) {
+                return;
+            }
+            Clock::time_point now = Clock::now();
+            RequestType type;
+            uint32_t id = 0;
+            bool bad_request = false;
+
+            if (buffer[0] == (char) EVENTS) {
+                type = EVENTS_REQUEST;
+            }
+            else if (buffer[0] == (char) RESERVATION && length == 67) {
+                uint32_t reservation_id;
+                memcpy(&reservation_id, buffer + 1, 4);
+                memcpy(&id, buffer + 5, 4);
+                id = ntohl(id);
+                type = RESERVATION_REQUEST;
+                add_to_pool(ntohl(reservation_id), buffer + 11);
+            }
+            else if (buffer[0] == (char) TICKETS && length >= 7) {
+                memcpy(&id, buffer + 1, 4);
+                id = ntohl(id);
+                type = TICKETS_REQUEST;
+            }
+            else if (buffer[0] == (char) BAD_REQUEST && length == 5) {
+                memcpy(&id, buffer + 1, 4);
+                id = ntohl(id);
+                type = id < FIRST_RESERVATION_ID ? RESERVATION_REQUEST : TICKETS_REQUEST;
+                bad_request = true;
+            }
+            else {
+                continue;
+            }
+
+            auto entry = pending[socket_index].find(pending_key(type, id));
+            if (entry == pending[socket_index].end()) {
+                continue;
+            }
+            Clock::time_point scheduled = entry->second.front();
+            entry->second.pop_front();
+            if (entry->second.empty()) {
+                pending[socket_index].erase(entry);
+            }
+
+            statistics.bad_requests[type] += bad_request;
+            statistics.latencies[type].record(chrono::duration_cast<chrono::nanoseconds>(now - scheduled).count());
+        }
+    }
+
+    void add_to_pool(uint32_t reservation_id, const char *cookie) {
+        ReservationTicket reservation{};
+        reservation.reservation_id = reservation_id;
+        memcpy(reservation.cookie, cookie, COOKIE_SIZE);
+        if (reservation_pool.size() < MAX_RESERVATION_POOL) {
+            reservation_pool.push_back(reservation);
+        }
+        else {
+            reservation_pool[random() % reservation_pool.size()] = reservation;
+        }
+    }
+};
+
+// Sends the request until a reply of the type comes, returns its length or 0 when none does.
+ssize_t exchange(int socket_fd, const char *request, size_t length, uint8_t reply_type, char *reply) {
+    for (int attempt = 0; attempt < 5; attempt++) {
+        send(socket_fd, request, length, 0);
+        ssize_t received = recv(socket_fd, reply, MAX_MESSAGE_LENGTH, 0);
+        if (received > 0 && (uint8_t) reply[0] == reply_type) {
+            return received;
+        }
+    }
+    return 0;
+}
+
+// One past the largest event id among the entries after the header of an EVENTS or EVENTS_PAGE reply, or `end`
+// when that is larger.
+uint32_t event_ids_end(const char *reply, ssize_t header_size, ssize_t length, uint32_t end) {
+    for (ssize_t index = header_size; index + 7 <= length; index += 7 + (uint8_t) reply[index + 6]) {
+        uint32_t event_id;
+        memcpy(&event_id, reply + index, sizeof(event_id));
+        end = max(end, ntohl(event_id) + 1);
+    }
+    return end;
+}
+
+// Asks the server for the events once, so that reservations target existing event ids. The EVENTS message
+// holds only the events that fit in one datagram, so the pages are walked to the last event. A server that
+// does not answer GET_EVENTS_PAGE is counted from the EVENTS message.
+uint32_t fetch_event_count(const Parameters &parameters) {
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (socket_fd < 0 || connect(socket_fd, (const sockaddr *) &parameters.server_address,
+                                 sizeof(parameters.server_address)) != 0) {
+        fatal("creating of a client socket failed.");
+    }
+
+    static char buffer[MAX_MESSAGE_LENGTH];
+    uint32_t count = 0;
+    uint32_t event_id = 0;
+    while (event_id != NO_MORE_EVENTS) {
+        char request[EVENTS_PAGE_HEADER_SIZE] = { (char) GET_EVENTS_PAGE };
+        uint32_t network_event_id = htonl(event_id);
+        memcpy(request + 1, &network_event_id, sizeof(network_event_id));
+        ssize_t length = exchange(socket_fd, request, sizeof(request), EVENTS_PAGE, buffer);
+        if (length < EVENTS_PAGE_HEADER_SIZE) {
+            break;
+        }
+        count = event_ids_end(buffer, EVENTS_PAGE_HEADER_SIZE, length, count);
+
+        uint32_t next_event_id;
+        memcpy(&next_event_id, buffer + 1, sizeof(next_event_id));
+        next_event_id = ntohl(next_event_id);
+        if (next_event_id <= event_id) {
+            break;
+        }
+        event_id = next_event_id;
+    }
+
+    if (count == 0) {
+        char request = GET_EVENTS;
+        ssize_t length = exchange(socket_fd, &request, 1, EVENTS, buffer);
+        if (length == 0) {
+            fatal("the server does not answer GET_EVENTS.");
+        }
+        count = event_ids_end(buffer, 1, length, 0);
+    }
+    close(socket_fd);
+    if (count == 0) {
+        fatal("the server has no events.");
+    }
+    return count;
+}
+
+void print_report(const Parameters &parameters, const Statistics &statistics, double elapsed) {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    for (size_t i = 0; i < REQUEST_TYPES; i++) {
+        sent += statistics.sent[i];
+        received += statistics.latencies[i].count();
+    }
+    uint64_t lost = sent - received;
+
+    printf("target rate %.0f/s, sent %" PRIu64 ", received %" PRIu64 ", lost %" PRIu64 " (%.3f%%), "
+           "throughput %.0f replies/s\n", parameters.rate, sent, received, lost,
+           sent ? 100.0 * (double) lost / (double) sent : 0.0, (double) received / elapsed);
+    printf("%-16s %10s %10s %10s %10s %10s %10s\n", "request", "sent", "received", "bad", "p50 us", "p99 us",
+           "p999 us");
+
+    Histogram all;
+    for (size_t i = 0; i < REQUEST_TYPES; i++) {
+        const Histogram &latency = statistics.latencies[i];
+        all.merge(latency);
+        printf("%-16s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10.1f %10.1f %10.1f\n", REQUEST_NAMES[i],
+               statistics.sent[i], latency.count(), statistics.bad_requests[i], latency.percentile(0.5) / 1e3,
+               latency.percentile(0.99) / 1e3, latency.percentile(0.999) / 1e3);
+    }
+    printf("%-16s %10" PRIu64 " %10" PRIu64 " %10s %10.1f %10.1f %10.1f\n", "all", sent, received, "",
+           all.percentile(0.5) / 1e3, all.percentile(0.99) / 1e3, all.percentile(0.999) / 1e3);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Parameters parameters = parse_args(argc, argv);
+    if (!parameters.generate_path.empty()) {
+        generate_events_file(parameters);
+        return 0;
+    }
+
+    uint32_t event_count = fetch_event_count(parameters);
+    random_device seed;
+    vector<unique_ptr<LoadThread>> load_threads;
+    for (size_t i = 0; i < parameters.threads; i++) {
+        size_t socket_count = parameters.sockets / parameters.threads + (i < parameters.sockets % parameters.threads);
+        load_threads.push_back(make_unique<LoadThread>(parameters, socket_count,
+                                                       parameters.rate / (double) parameters.threads,
+                                                       event_count, ((uint64_t) seed() << 32) | seed()));
+    }
+
+    Clock::time_point start = Clock::now() + chrono::milliseconds(10);
+    Clock::time_point end = start + chrono::duration_cast<Clock::duration>(
+            chrono::duration<double>(parameters.duration));
+    Clock::time_point drain_end = end + chrono::duration_cast<Clock::duration>(
+            chrono::duration<double>(parameters.drain));
+
+    vector<thread> threads;
+    for (auto &load_thread : load_threads) {
+        threads.emplace_back([&load_thread, start, end, drain_end] { load_thread->run(start, end, drain_end); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    Statistics statistics;
+    for (auto &load_thread : load_threads) {
+        statistics.merge(load_thread->statistics);
+    }
+    print_report(parameters, statistics, parameters.duration);
+
+    return 0;
+}
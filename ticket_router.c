@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include "server.h"
+
+#define DEFAULT_REFRESH_INTERVAL_MS 100
+#define MAX_REFRESH_INTERVAL_MS 60000
+#define NODE_TIMEOUT_MS 200
+// Sockets the requests are forwarded from. A node spreads datagrams over its workers by their source, so one
+// socket would put all forwarded load on a single worker.
+#define NODE_SOCKETS 16
+
+// A ticket_server started with `-n <index>/<nodes> -e <first>-<last>`, it reserves the tickets of its events
+// and picks up its reservations.
+typedef struct Node {
+    struct sockaddr_in address;
+    uint32_t first_event_id;
+    uint32_t last_event_id;
+} Node;
+
+// Forwards GET_RESERVATION to the node owning the event and GET_TICKETS to the node owning the range of the
+// reservation id, wrapped with the address of the client, and passes the replies back. GET_EVENTS is answered
+// from a merged copy of the events of all nodes, refreshed in the background.
+typedef struct Router {
+    Node nodes[MAX_NODES];
+    size_t node_count;
+    uint16_t port;
+    long refresh_interval_ms;
+    int client_fd;
+    // Requests of a client always leave from the same socket, so they keep reaching the same worker.
+    int node_fds[NODE_SOCKETS];
+    pthread_mutex_t mutex;
+    char *events;
+    size_t events_length;
+} Router;
+
+void fatal_usage(char *message) {
+    fprintf(stderr, "Error: %s\nUsage: [-p <port>] [-i <events refresh interval in ms>] [-v <log level>] "
+                    "-n <address>:<port>:<first event>-[<last event>] [-n ...]\n", message);
+    exit(1);
+}
+
+static bool parse_node(char *text, Node *node) {
+    char *port = strchr(text, ':');
+    if (port == NULL) {
+        return false;
+    }
+    *port++ = '\0';
+
+    char *ptr;
+    long port_number = strtol(port, &ptr, 10);
+    if (*ptr != ':' || port_number < 0 || port_number > 65535) {
+        return false;
+    }
+    long first_event_id = strtol(ptr + 1, &ptr, 10);
+    if (*ptr != '-' || first_event_id < 0 || first_event_id > UINT32_MAX) {
+        return false;
+    }
+    long last_event_id = UINT32_MAX;
+    if (ptr[1] != '\0') {
+        last_event_id = strtol(ptr + 1, &ptr, 10);
+        if (*ptr != '\0') {
+            return false;
+        }
+    }
+    if (last_event_id < first_event_id || last_event_id > UINT32_MAX) {
+        return false;
+    }
+
+    *node = (Node) { .address = { .sin_family = AF_INET, .sin_port = htons((uint16_t) port_number) },
+                     .first_event_id = (uint32_t) first_event_id, .last_event_id = (uint32_t) last_event_id };
+    return inet_pton(AF_INET, text, &node->address.sin_addr) == 1;
+}
+
+void parse_args(int argc, char *argv[], Router *router) {
+    int opt;
+    LogLevel log_level = LOG_WARNING;
+    while ((opt = getopt(argc, argv, "p:i:v:n:")) != -1) {
+        char *ptr;
+        long value;
+        switch (opt) {
+            case 'p':
+                value = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || value < 0 || value > 65535) {
+                    fatal_usage("parameter value is not a proper port.");
+                }
+                router->port = (uint16_t) value;
+                break;
+            case 'i':
+                router->refresh_interval_ms = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || router->refresh_interval_ms < 1
+                    || router->refresh_interval_ms > MAX_REFRESH_INTERVAL_MS) {
+                    fatal_usage("parameter value is not a proper refresh interval.");
+                }
+                break;
+            case 'v':
+                if (!parse_log_level(optarg, &log_level)) {
+                    fatal_usage("parameter value is not a proper log level.");
+                }
+                break;
+            case 'n':
+                if (router->node_count == MAX_NODES) {
+                    fatal_usage("too many nodes.");
+                }
+                if (!parse_node(optarg, &router->nodes[router->node_count++])) {
+                    fatal_usage("parameter value is not a proper node.");
+                }
+                break;
+            default:
+                fatal_usage("improper_usage.");
+        }
+    }
+
+    if (optind < argc) {
+        fatal_usage("improper_usage.");
+    }
+    if (router->node_count == 0) {
+        fatal_usage("no nodes set.");
+    }
+    set_log_level(log_level);
+}
+
+static Node *node_of_event(Router *router, uint32_t event_id) {
+    for (size_t i = 0; i < router->node_count; i++) {
+        if (router->nodes[i].first_event_id <= event_id && event_id <= router->nodes[i].last_event_id) {
+            return &router->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+static Node *node_of_reservation(Router *router, uint32_t reservation_id) {
+    if (reservation_id < FIRST_RESERVATION_ID) {
+        return NULL;
+    }
+    size_t index = (reservation_id - FIRST_RESERVATION_ID) / node_reservation_ids(router->node_count);
+    return index < router->node_count ? &router->nodes[index] : NULL;
+}
+
+// First event after `event_id` owned by any node, NO_MORE_EVENTS if there is none.
+static uint32_t next_owned_event(Router *router, uint32_t event_id) {
+    uint32_t next = NO_MORE_EVENTS;
+    for (size_t i = 0; i < router->node_count; i++) {
+        uint32_t first = router->nodes[i].first_event_id;
+        if (first > event_id && first < next) {
+            next = first;
+        }
+    }
+    return next;
+}
+
+static void send_bad_request_to(Router *router, uint32_t id, const struct sockaddr_in *client_address) {
+    char message[BAD_REQUEST_MESSAGE_SIZE];
+    BadRequestMessage bad_request = { .id = id };
+    encode_bad_request(message, &bad_request);
+    sendto(router->client_fd, message, sizeof(message), 0, (const struct sockaddr *) client_address,
+           sizeof(*client_address));
+}
+
+static void forward_request(Router *router, Node *node, const char *request, size_t length,
+                            const struct sockaddr_in *client_address) {
+    char message[FORWARD_HEADER_SIZE + RECEIVE_BUFFER_SIZE];
+    message[0] = FORWARD;
+    memcpy(message + 1, &client_address->sin_addr.s_addr, 4);
+    memcpy(message + 5, &client_address->sin_port, 2);
+    memcpy(message + FORWARD_HEADER_SIZE, request, length);
+    uint32_t hash = (client_address->sin_addr.s_addr ^ client_address->sin_port) * 2654435761U;
+    int node_fd = router->node_fds[(hash >> 16) % NODE_SOCKETS];
+    sendto(node_fd, message, FORWARD_HEADER_SIZE + length, 0, (const struct sockaddr *) &node->address,
+           sizeof(node->address));
+}
+
+static void process_request(Router *router, const char *request, size_t length,
+                            const struct sockaddr_in *client_address) {
+    uint32_t id;
+    Node *node;
+    switch (request_kind_of(request, length)) {
+        case REQUEST_GET_EVENTS:
+            CHECK(pthread_mutex_lock(&router->mutex));
+            sendto(router->client_fd, router->events, router->events_length, 0,
+                   (const struct sockaddr *) client_address, sizeof(*client_address));
+            CHECK(pthread_mutex_unlock(&router->mutex));
+            return;
+        case REQUEST_GET_RESERVATION:
+            id = decode_get_reservation(request + 1).event_id;
+            node = node_of_event(router, id);
+            break;
+        case REQUEST_GET_EVENTS_PAGE:
+            id = decode_get_events_page(request + 1).event_id;
+            node = node_of_event(router, id);
+            break;
+        case REQUEST_GET_TICKETS:
+            id = decode_get_tickets(request + 1).reservation_id;
+            node = node_of_reservation(router, id);
+            break;
+        default:
+            return;
+    }
+
+    if (node == NULL) {
+        send_bad_request_to(router, id, client_address);
+        return;
+    }
+    forward_request(router, node, request, length, client_address);
+}
+
+// Keeps only the events of the node in a page it sent, the page then points to the events of the next node.
+static size_t trim_page(Router *router, const Node *node, char *page, size_t length) {
+    size_t kept = EVENTS_PAGE_HEADER_SIZE;
+    for (size_t index = EVENTS_PAGE_HEADER_SIZE; index + EVENT_ENTRY_SIZE <= length; ) {
+        uint32_t event_id = read_uint32_t(page + index);
+        size_t size = event_entry_length(page + index);
+        if (node->first_event_id <= event_id && event_id <= node->last_event_id) {
+            memmove(page + kept, page + index, size);
+            kept += size;
+        }
+        index += size;
+    }
+
+    EventsPageMessage header = decode_events_page(page + 1);
+    if (header.next_event_id != NO_MORE_EVENTS && header.next_event_id > node->last_event_id) {
+        header.next_event_id = next_owned_event(router, node->last_event_id);
+        encode_events_page(page, &header);
+    }
+    return kept;
+}
+
+static void process_reply(Router *router, char *reply, size_t length, const struct sockaddr_in *node_address) {
+    if (length <= FORWARD_HEADER_SIZE || reply[0] != FORWARDED) {
+        return;
+    }
+    struct sockaddr_in client_address = { .sin_family = AF_INET };
+    memcpy(&client_address.sin_addr.s_addr, reply + 1, 4);
+    memcpy(&client_address.sin_port, reply + 5, 2);
+    char *message = reply + FORWARD_HEADER_SIZE;
+    length -= FORWARD_HEADER_SIZE;
+
+    if (message[0] == EVENTS_PAGE && length >= EVENTS_PAGE_HEADER_SIZE) {
+        for (size_t i = 0; i < router->node_count; i++) {
+            Node *node = &router->nodes[i];
+            if (node->address.sin_addr.s_addr == node_address->sin_addr.s_addr
+                && node->address.sin_port == node_address->sin_port) {
+                length = trim_page(router, node, message, length);
+                break;
+            }
+        }
+    }
+    sendto(router->client_fd, message, length, 0, (const struct sockaddr *) &client_address,
+           sizeof(client_address));
+}
+
+// Asks the node for the page of the event, returns its length, 0 when the node has no such event or -1 when it
+// does not answer.
+static ssize_t fetch_page(int socket_fd, const Node *node, uint32_t event_id, char *page) {
+    while (recv(socket_fd, page, MAX_MESSAGE_LENGTH, MSG_DONTWAIT) >= 0) {
+        // Late answers to earlier requests.
+    }
+
+    char request[GET_EVENTS_PAGE_MESSAGE_SIZE];
+    GetEventsPageMessage message = { .event_id = event_id };
+    encode_get_events_page(request, &message);
+    sendto(socket_fd, request, sizeof(request), 0, (const struct sockaddr *) &node->address, sizeof(node->address));
+
+    struct pollfd poll_fd = { .fd = socket_fd, .events = POLLIN };
+    if (poll(&poll_fd, 1, NODE_TIMEOUT_MS) <= 0) {
+        return -1;
+    }
+    ssize_t received = recv(socket_fd, page, MAX_MESSAGE_LENGTH, MSG_DONTWAIT);
+    if (received > 0 && page[0] == (char) BAD_REQUEST) {
+        return 0;
+    }
+    return received >= EVENTS_PAGE_HEADER_SIZE && page[0] == EVENTS_PAGE ? received : -1;
+}
+
+// Builds the EVENTS message from the pages of the nodes, their events in the order of the ranges, as long as
+// they fit. Returns false when a node did not answer.
+static bool merge_events(Router *router, int socket_fd, char *page, char *events, size_t *events_length) {
+    size_t length = 1;
+    events[0] = EVENTS;
+
+    Node *node;
+    uint32_t event_id = node_of_event(router, 0) != NULL ? 0 : next_owned_event(router, 0);
+    while (event_id != NO_MORE_EVENTS && (node = node_of_event(router, event_id)) != NULL) {
+        ssize_t received = fetch_page(socket_fd, node, event_id, page);
+        if (received < 0) {
+            log_record(LOG_NODE_NOT_ANSWERING, (size_t) (node - router->nodes));
+            return false;
+        }
+        if (received == 0) {
+            break;
+        }
+        size_t page_length = trim_page(router, node, page, (size_t) received);
+
+        for (size_t index = EVENTS_PAGE_HEADER_SIZE; index + EVENT_ENTRY_SIZE <= page_length; ) {
+            size_t size = event_entry_length(page + index);
+            if (length + size > MAX_MESSAGE_LENGTH) {
+                *events_length = length;
+                return true;
+            }
+            memcpy(events + length, page + index, size);
+            length += size;
+            index += size;
+        }
+
+        event_id = decode_events_page(page + 1).next_event_id;
+    }
+    *events_length = length;
+    return true;
+}
+
+static _Noreturn void *run_refresher(void *router_ptr) {
+    Router *router = router_ptr;
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ENSURE(socket_fd > 0);
+    char *page = safe_malloc(MAX_MESSAGE_LENGTH);
+    char *events = safe_malloc(MAX_MESSAGE_LENGTH);
+    struct timespec interval = { .tv_sec = router->refresh_interval_ms / 1000,
+                                 .tv_nsec = router->refresh_interval_ms % 1000 * 1000000 };
+
+    while (true) {
+        size_t events_length;
+        if (merge_events(router, socket_fd, page, events, &events_length)) {
+            CHECK(pthread_mutex_lock(&router->mutex));
+            char *previous = router->events;
+            router->events = events;
+            router->events_length = events_length;
+            events = previous;
+            CHECK(pthread_mutex_unlock(&router->mutex));
+        }
+        nanosleep(&interval, NULL);
+    }
+}
+
+static void receive_all(Router *router, int socket_fd, char *buffer) {
+    while (true) {
+        struct sockaddr_in address;
+        socklen_t address_length = sizeof(address);
+        errno = 0;
+        ssize_t received = recvfrom(socket_fd, buffer, MAX_MESSAGE_LENGTH, MSG_DONTWAIT,
+                                    (struct sockaddr *) &address, &address_length);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED) {
+                PRINT_ERRNO();
+            }
+            return;
+        }
+        if (socket_fd == router->client_fd) {
+            process_request(router, buffer, (size_t) received, &address);
+        }
+        else {
+            process_reply(router, buffer, (size_t) received, &address);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Router router = { .port = 2022, .refresh_interval_ms = DEFAULT_REFRESH_INTERVAL_MS, .node_count = 0 };
+    parse_args(argc, argv, &router);
+
+    router.client_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    ENSURE(router.client_fd > 0);
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY),
+                                   .sin_port = htons(router.port) };
+    CHECK_ERRNO(bind(router.client_fd, (struct sockaddr *) &address, (socklen_t) sizeof(address)));
+    for (size_t i = 0; i < NODE_SOCKETS; i++) {
+        router.node_fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        ENSURE(router.node_fds[i] > 0);
+    }
+
+    CHECK(pthread_mutex_init(&router.mutex, NULL));
+    router.events = safe_malloc(MAX_MESSAGE_LENGTH);
+    router.events[0] = EVENTS;
+    router.events_length = 1;
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, run_refresher, &router));
+    CHECK(pthread_detach(thread));
+
+    log_record(LOG_ROUTER_LISTENING, router.port, router.node_count);
+    char *buffer = safe_malloc(MAX_MESSAGE_LENGTH);
+    struct pollfd poll_fds[1 + NODE_SOCKETS] = { { .fd = router.client_fd, .events = POLLIN } };
+    for (size_t i = 0; i < NODE_SOCKETS; i++) {
+        poll_fds[1 + i] = (struct pollfd) { .fd = router.node_fds[i], .events = POLLIN };
+    }
+    while (true) {
+        if (poll(poll_fds, 1 + NODE_SOCKETS, -1) < 0 && errno != EINTR) {
+            PRINT_ERRNO();
+        }
+        for (size_t i = 0; i < 1 + NODE_SOCKETS; i++) {
+            if (poll_fds[i].revents != 0) {
+                receive_all(&router, poll_fds[i].fd, buffer);
+            }
+        }
+    }
+}
@@ -1,66 +1,54 @@
 #define _GNU_SOURCE
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <stdint.h>
-#include <time.h>
-#include <errno.h>
 #include <getopt.h>
 #include <unistd.h>
-#include <stdarg.h>
-
-#define GET_EVENTS 1
-#define EVENTS 2
-#define GET_RESERVATION 3
-#define RESERVATION 4
-#define GET_TICKETS 5
-#define TICKETS 6
-#define BAD_REQUEST 255
-
-#define COOKIE_SIZE 48
-#define NO_TICKETS (-1)
-#define MAX_MESSAGE_LENGTH 65507
-#define GET_EVENTS_MESSAGE_SIZE 1
-#define GET_RESERVATION_MESSAGE_SIZE 7
-#define GET_TICKETS_MESSAGE_SIZE 53
-
-#define ENSURE(x)                                                         \
-    do {                                                                  \
-        bool result = (x);                                                \
-        if (!result) {                                                    \
-            fprintf(stderr, "Error: %s was false in %s at %s:%d\n",       \
-                #x, __func__, __FILE__, __LINE__);                        \
-            exit(EXIT_FAILURE);                                           \
-        }                                                                 \
-    } while (0)
-
-#define PRINT_ERRNO()                                                  \
-    do {                                                               \
-        if (errno != 0) {                                              \
-            fprintf(stderr, "Error: errno %d in %s at %s:%d\n%s\n",    \
-              errno, __func__, __FILE__, __LINE__, strerror(errno));   \
-            exit(EXIT_FAILURE);                                        \
-        }                                                              \
-    } while (0)
-
-#define CHECK_ERRNO(x)                                                             \
-    do {                                                                           \
-        errno = 0;                                                                 \
-        (void) (x);                                                                \
-        PRINT_ERRNO();                                                             \
-    } while (0)
-
-int bind_socket(uint16_t port) {
+#include <pthread.h>
+#include <linux/filter.h>
+#include <sys/random.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+
+#include "server.h"
+#include "uring.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "reload.h"
+#include "trace.h"
+#include "event_loop.h"
+
+#define DEFAULT_BATCH_SIZE 32
+#define MAX_BATCH_SIZE 1024
+#define MAX_WORKERS 64
+#define MAX_COMMIT_WINDOW 1000000
+#define MAX_SNAPSHOT_INTERVAL 86400
+#define DEFAULT_RETRANSMISSION_WINDOW 2
+#define MAX_TICKETS_CACHE_BYTES (1L << 34)
+#define MAX_BUSY_POLL 1000000
+
+// Metrics endpoint, any datagram sent to it is answered with the current metrics of all workers, except
+// "reload", which reloads the catalog, and "log <level>", which sets the log level. Both are answered with
+// the outcome. Served by the control thread, which also reloads the catalog on SIGHUP.
+typedef struct AdminServer {
+    Server *servers;
+    size_t workers;
+    Reloader *reloader;
+    // -1 when the metrics endpoint is disabled.
+    int socket_fd;
+    char *message;
+} AdminServer;
+
+int bind_socket(uint32_t address, uint16_t port, bool reuse_port) {
     int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
     ENSURE(socket_fd > 0);
 
+    if (reuse_port) {
+        int enable = 1;
+        CHECK_ERRNO(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)));
+    }
+
     struct sockaddr_in server_address;
     server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    server_address.sin_addr.s_addr = htonl(address);
     server_address.sin_port = htons(port);
 
     CHECK_ERRNO(bind(socket_fd, (struct sockaddr *) &server_address,
@@ -69,145 +57,73 @@ int bind_socket(uint16_t port) {
     return socket_fd;
 }
 
-size_t read_message(int socket_fd, struct sockaddr_in *client_address, char *buffer, size_t max_length) {
-    socklen_t address_length = (socklen_t) sizeof(*client_address);
-    int flags = 0;
-    errno = 0;
-    ssize_t len = recvfrom(socket_fd, buffer, max_length, flags,
-                           (struct sockaddr *) client_address, &address_length);
-    if (len < 0) {
-        PRINT_ERRNO();
-    }
-    return (size_t) len;
-}
-
-void send_message(int socket_fd, const struct sockaddr_in *client_address, const char *message, size_t length) {
-    socklen_t address_length = (socklen_t) sizeof(*client_address);
-    int flags = 0;
-    ssize_t sent_length = sendto(socket_fd, message, length, flags,
-                                 (struct sockaddr *) client_address, address_length);
-    ENSURE(sent_length == (ssize_t) length);
-}
-
-static inline uint64_t htonll(uint64_t x) {
-    return ((((uint64_t)htonl(x)) << 32) + htonl((x) >> 32));
-}
-
-static inline uint64_t ntohll(uint64_t x) {
-    return htonll(x);
-}
-
-void fatal(char *message) {
-    fprintf(stderr, "Error: %s\n", message);
-    exit(1);
+// GET_TICKETS is delivered to the worker that owns the reservation, worker `i` hands out reservation ids
+// `first_id + i` modulo the number of workers. A GET_TICKETS forwarded by a router is steered by the request
+// after the forward header. Other datagrams are spread by the default SO_REUSEPORT hash, which the kernel
+// falls back to when the returned socket index is out of range.
+void attach_steering_program(int socket_fd, size_t workers, uint32_t first_id) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, GET_TICKETS, 5, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FORWARD, 0, 8),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, FORWARD_HEADER_SIZE),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, GET_TICKETS, 0, 6),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, FORWARD_HEADER_SIZE + 1),
+        BPF_STMT(BPF_JMP | BPF_JA, 1),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 1),
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, first_id),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, (uint32_t) workers),
+    };
+    struct sock_fprog program = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+    CHECK_ERRNO(setsockopt(socket_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)));
 }
 
 void fatal_usage(char *message) {
-    fprintf(stderr, "Error: %s\nUsage: -f <path to events file> [-p <port>] [-t <timeout>]", message);
+    fprintf(stderr, "Error: %s\nUsage: -f <path to events file> [-p <port>] [-t <timeout>] [-b <batch size>] "
+                    "[-w <workers>] [-a <admin port>] [-u] "
+                    "[-c <compiled catalog to write>] [-j <journal directory>] [-g <commit window in us>] "
+                    "[-s <snapshot interval in seconds>] [-r <retransmission window in seconds>] "
+                    "[-l <type>=<rate>/<burst>[,...]] [-v <log level>] [-m <tickets cache bytes>] "
+                    "[-n <node>/<nodes> [-e <first event>-[<last event>]]] "
+                    "[-x <trace directory>] [-y <trace to replay> | -Y <trace to replay at full speed>] "
+                    "[-B <busy poll in us>] [-C <first cpu>]", message);
     exit(1);
 }
 
-void print_debug(__attribute__ ((unused)) const char *format, ...) {
-#ifndef NDEBUG
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-#endif
-}
-
-void *safe_malloc(size_t size) {
-    void *ptr = malloc(size);
-    if (!ptr) {
-        fatal("memory allocation failed.");
-    }
-    return ptr;
-}
-
-void *safe_realloc(void *ptr, size_t size) {
-    ptr = realloc(ptr, size);
-    if (!ptr) {
-        fatal("memory allocation failed.");
-    }
-    return ptr;
-}
-
-typedef struct Parameters {
-    FILE *file_ptr;
-    int port;
-    int time_limit;
-} Parameters;
-
-typedef struct Event {
-    char *description;
-    uint8_t description_length;
-    uint16_t tickets;
-} Event;
-
-typedef struct DynamicArray {
-    void **arr;
-    size_t reserved;
-    size_t count;
-} DynamicArray;
-
-
-DynamicArray new_dynamic_array() {
-    size_t reserved = 1;
-    size_t count = 0;
-    void **array = safe_malloc(reserved * sizeof(void *));
-    return (DynamicArray) { .count = count, .reserved = reserved, .arr = array };
-}
-
-void add_to_dynamic_array(DynamicArray *array, void *item) {
-    array->count++;
-    if (array->count == array->reserved) {
-        array->reserved *= 2;
-        array->arr = safe_realloc(array->arr, array->reserved * sizeof(Event));
-    }
-    array->arr[array->count - 1] = item;
-}
-
-void destroy_dynamic_array(DynamicArray *array) {
-    for (size_t i = 0; i < array->count; i++) {
-        free(array->arr[i]);
-    }
-}
-
-typedef struct ReservationsContainer {
-    DynamicArray reservations_array;
-    size_t outdated_count;
-    size_t first_not_outdated;
-    uint32_t next_id;
-} ReservationsContainer;
-
-typedef struct __attribute__((__packed__)) Reservation {
-    uint32_t reservation_id;
-    uint32_t event_id;
-    uint16_t ticket_count;
-    char cookie[COOKIE_SIZE];
-    uint64_t expiration_time;
-    int64_t first_ticket_id;
-} Reservation;
-
-typedef struct Server {
-    Parameters parameters;
-    int socket_fd;
-    DynamicArray event_array;
-    ReservationsContainer reservations;
-    int64_t next_ticket_id;
-    uint64_t time_when_received;
-    char message[MAX_MESSAGE_LENGTH];
-} Server;
-
 Parameters parse_args(int argc, char *argv[]) {
     FILE *file_ptr = NULL;
+    char *events_path = NULL;
     int port = 2022;
+    int admin_port = -1;
     int time_limit = 5;
+    long batch_size = DEFAULT_BATCH_SIZE;
+    long workers = 1;
+    bool use_uring = false;
+    char *catalog_path = NULL;
+    char *journal_directory = NULL;
+    long commit_window = 0;
+    long snapshot_interval = 0;
+    long retransmission_window = DEFAULT_RETRANSMISSION_WINDOW;
+    RateBudget rate_limits[RATE_LIMITED_KINDS] = { { 0 } };
+    LogLevel log_level = LOG_WARNING;
+    long tickets_cache_bytes = DEFAULT_TICKETS_CACHE_BYTES;
+    long node = 0;
+    long nodes = 0;
+    long first_event_id = 0;
+    long last_event_id = UINT32_MAX;
+    bool range_set = false;
+    char *trace_directory = NULL;
+    char *replay_path = NULL;
+    bool replay_fast = false;
+    long busy_poll = 0;
+    long first_cpu = -1;
 
     bool file_set = false;
     int opt;
 
-    while ((opt = getopt(argc, argv, "f:p:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "f:p:t:b:w:a:uc:j:g:s:r:l:v:m:n:e:x:y:Y:B:C:")) != -1) {
         char *ptr;
         switch (opt) {
             case 'f':
@@ -219,6 +135,7 @@ Parameters parse_args(int argc, char *argv[]) {
                 if (!file_ptr) {
                     fatal_usage("opening of the events file failed.");
                 }
+                events_path = optarg;
                 break;
             case 'p':
                 port = (int) strtol(optarg, &ptr, 10);
@@ -232,6 +149,112 @@ Parameters parse_args(int argc, char *argv[]) {
                     fatal_usage("parameter value is not a proper time limit.");
                 }
                 break;
+            case 'b':
+                batch_size = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || batch_size < 1 || batch_size > MAX_BATCH_SIZE) {
+                    fatal_usage("parameter value is not a proper batch size.");
+                }
+                break;
+            case 'w':
+                workers = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || workers < 1 || workers > MAX_WORKERS) {
+                    fatal_usage("parameter value is not a proper number of workers.");
+                }
+                break;
+            case 'a':
+                admin_port = (int) strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || admin_port < 0 || admin_port > 65535) {
+                    fatal_usage("parameter value is not a proper admin port.");
+                }
+                break;
+            case 'u':
+                use_uring = true;
+                break;
+            case 'c':
+                catalog_path = optarg;
+                break;
+            case 'j':
+                journal_directory = optarg;
+                break;
+            case 'g':
+                commit_window = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || commit_window < 0 || commit_window > MAX_COMMIT_WINDOW) {
+                    fatal_usage("parameter value is not a proper commit window.");
+                }
+                break;
+            case 's':
+                snapshot_interval = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || snapshot_interval < 0 || snapshot_interval > MAX_SNAPSHOT_INTERVAL) {
+                    fatal_usage("parameter value is not a proper snapshot interval.");
+                }
+                break;
+            case 'r':
+                retransmission_window = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || retransmission_window < 0 || retransmission_window > 86400) {
+                    fatal_usage("parameter value is not a proper retransmission window.");
+                }
+                break;
+            case 'l':
+                if (!parse_rate_limits(optarg, rate_limits)) {
+                    fatal_usage("parameter value is not a proper list of rate limits.");
+                }
+                break;
+            case 'v':
+                if (!parse_log_level(optarg, &log_level)) {
+                    fatal_usage("parameter value is not a proper log level.");
+                }
+                break;
+            case 'm':
+                tickets_cache_bytes = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || tickets_cache_bytes < 0 || tickets_cache_bytes > MAX_TICKETS_CACHE_BYTES) {
+                    fatal_usage("parameter value is not a proper size of the tickets cache.");
+                }
+                break;
+            case 'n':
+                node = strtol(optarg, &ptr, 10);
+                if (*ptr != '/') {
+                    fatal_usage("parameter value is not a proper node.");
+                }
+                nodes = strtol(ptr + 1, &ptr, 10);
+                if (*ptr != '\0' || nodes < 1 || nodes > MAX_NODES || node < 0 || node >= nodes) {
+                    fatal_usage("parameter value is not a proper node.");
+                }
+                break;
+            case 'e':
+                range_set = true;
+                last_event_id = UINT32_MAX;
+                first_event_id = strtol(optarg, &ptr, 10);
+                if (*ptr != '-' || first_event_id < 0 || first_event_id > UINT32_MAX) {
+                    fatal_usage("parameter value is not a proper range of events.");
+                }
+                if (ptr[1] != '\0') {
+                    last_event_id = strtol(ptr + 1, &ptr, 10);
+                    ptr = *ptr == '\0' ? ptr : NULL;
+                }
+                if (ptr == NULL || last_event_id < first_event_id || last_event_id > UINT32_MAX) {
+                    fatal_usage("parameter value is not a proper range of events.");
+                }
+                break;
+            case 'x':
+                trace_directory = optarg;
+                break;
+            case 'y':
+            case 'Y':
+                replay_path = optarg;
+                replay_fast = opt == 'Y';
+                break;
+            case 'B':
+                busy_poll = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || busy_poll < 0 || busy_poll > MAX_BUSY_POLL) {
+                    fatal_usage("parameter value is not a proper busy poll time.");
+                }
+                break;
+            case 'C':
+                first_cpu = strtol(optarg, &ptr, 10);
+                if (*ptr != '\0' || first_cpu < 0 || first_cpu >= CPU_SETSIZE) {
+                    fatal_usage("parameter value is not a proper cpu.");
+                }
+                break;
             default:
                 fatal_usage("improper_usage.");
         }
@@ -243,386 +266,433 @@ Parameters parse_args(int argc, char *argv[]) {
     if (!file_ptr) {
         fatal_usage("events file not set.");
     }
+    if (snapshot_interval > 0 && journal_directory == NULL) {
+        fatal_usage("snapshots need a journal directory.");
+    }
+    if (range_set && nodes == 0) {
+        fatal_usage("a range of events needs a node.");
+    }
+    if (replay_path != NULL && (trace_directory != NULL || journal_directory != NULL)) {
+        fatal_usage("a replayed trace is neither captured nor journaled.");
+    }
+    if (first_cpu >= 0 && first_cpu + workers > CPU_SETSIZE) {
+        fatal_usage("workers do not fit in the cpus from the first one.");
+    }
+    // A reservation replayed after it expired would only be turned down at pick up.
+    if (retransmission_window > time_limit) {
+        retransmission_window = time_limit;
+    }
 
-    return (Parameters) { .file_ptr = file_ptr, .port = port, .time_limit = time_limit };
-}
-
-static inline size_t event_message_size(Event *event) {
-    return 7 + event->description_length;
+    Parameters parameters = { .file_ptr = file_ptr, .events_path = events_path, .port = port,
+                          .admin_port = admin_port, .time_limit = time_limit,
+                          .batch_size = (size_t) batch_size, .workers = (size_t) workers,
+                          .use_uring = use_uring, .catalog_path = catalog_path,
+                          .journal_directory = journal_directory, .commit_window = commit_window,
+                          .snapshot_interval = snapshot_interval, .retransmission_window = retransmission_window,
+                          .log_level = log_level, .tickets_cache_bytes = (size_t) tickets_cache_bytes,
+                          .node = (size_t) node, .nodes = (size_t) nodes,
+                          .first_event_id = (uint32_t) first_event_id, .last_event_id = (uint32_t) last_event_id,
+                          .trace_directory = trace_directory, .replay_path = replay_path,
+                          .replay_fast = replay_fast, .busy_poll = busy_poll, .first_cpu = first_cpu };
+    memcpy(parameters.rate_limits, rate_limits, sizeof(parameters.rate_limits));
+    return parameters;
 }
 
-DynamicArray read_file(Parameters *parameters) {
-    char *buff = NULL;
-    size_t buff_len;
-    char *description;
-    long long description_length;
-    long long digits_count;
-
-    uint16_t tickets;
-    size_t events_message_size = 1;
+void compile_events_file(Parameters *parameters) {
+    Catalog catalog = load_catalog_or_exit(parameters->file_ptr);
+    EventsMessage *events_message = build_events_message(&catalog);
+    compile_catalog(&catalog, events_message, parameters->catalog_path);
+    printf("Compiled %zu events into %s\n", catalog.count, parameters->catalog_path);
 
-    DynamicArray event_array = new_dynamic_array();
-
-    while ((description_length = getline(&buff, &buff_len, parameters->file_ptr)) >= 0) {
-        description = safe_malloc((size_t) (description_length - 1) * sizeof(char));
-        memcpy(description, buff, description_length - 1);
+    destroy_events_message(events_message);
+    destroy_catalog(&catalog);
+}
 
-        digits_count = getline(&buff, &buff_len, parameters->file_ptr);
-        if (digits_count <= 0) {
-            exit(0);
+// Feeds the datagrams of a trace through the same code as received ones, in batches like the ones a worker
+// reads, and prints the digest of the replies. Only the processing is timed, not the waiting for the recorded
+// pace or the digesting. The trace of one of several workers replays only its share, the tickets the other
+// workers took meanwhile are not taken.
+void replay_trace(Parameters *parameters) {
+    TraceReplay *replay = open_trace_replay(parameters->replay_path);
+    parameters->workers = replay->header.workers;
+
+    Catalog catalog = load_catalog_or_exit(parameters->file_ptr);
+    EventsMessage *events_message = build_events_message(&catalog);
+    Server server = initialize_server(*parameters, catalog, events_message, replay->header.cookie_key,
+                                      replay->header.worker_id, -1);
+    server.replay = replay;
+
+    const TraceRecord *record = next_trace_record(replay);
+    uint64_t first_time_ns = replay->time_ns;
+    uint64_t start_ns = monotonic_ns();
+    uint64_t busy_ns = 0;
+    uint64_t datagrams = 0;
+    server.reservations.timers.current_time = replay->time;
+
+    while (record != NULL) {
+        if (!parameters->replay_fast) {
+            uint64_t due_ns = start_ns + (record->time_ns - first_time_ns);
+            struct timespec due = { .tv_sec = (time_t) (due_ns / 1000000000), .tv_nsec = (long) (due_ns % 1000000000) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
         }
 
-        tickets = (uint16_t) strtol(buff, NULL, 10);
-
-        Event *event = safe_malloc(sizeof(Event));
-        *event = (Event) { .description = description, .description_length = description_length - 1,
-                           .tickets = tickets };
-        if (events_message_size + event_message_size(event) > MAX_MESSAGE_LENGTH) {
-            free(event);
-            break;
+        uint64_t batch_start_ns = monotonic_ns();
+        for (size_t i = 0; i < parameters->batch_size && record != NULL; i++) {
+            struct sockaddr_in client_address = { .sin_family = AF_INET, .sin_addr.s_addr = record->address,
+                                                  .sin_port = record->port };
+            process_message(&server, (const char *) (record + 1), record->length, client_address);
+            datagrams++;
+            record = next_trace_record(replay);
+            // At the recorded pace a batch holds only the datagrams that are due.
+            if (!parameters->replay_fast && record != NULL
+                && start_ns + (record->time_ns - first_time_ns) > monotonic_ns()) {
+                break;
+            }
         }
-        events_message_size += event_message_size(event);
-        add_to_dynamic_array(&event_array, event);
+        busy_ns += monotonic_ns() - batch_start_ns;
+        flush_messages(&server);
     }
 
-    fclose(parameters->file_ptr);
-    free(buff);
+    double seconds = (double) busy_ns / 1e9;
+    printf("Replayed %lu datagrams in %.3f s, %.0f datagrams per second.\n", datagrams, seconds,
+           seconds > 0 ? (double) datagrams / seconds : 0);
+    printf("%lu replies, %lu bytes, digest %016lx\n", replay->replies, replay->reply_bytes, replay->digest);
 
-    return event_array;
+    destroy_trace_replay(replay);
+    destroy_events_message(events_message);
+    destroy_catalog(&server.catalog);
+    destroy_server(&server);
 }
 
-Server initialize_server(int argc, char *argv[]) {
-    Parameters parameters = parse_args(argc, argv);
-    DynamicArray event_array = read_file(&parameters);
-
-    uint64_t current_time = time(NULL);
-    srand(21 * current_time + 37);
-    int socket_fd = bind_socket(parameters.port);
-
-    ReservationsContainer reservations = (ReservationsContainer) { .reservations_array = new_dynamic_array(),
-            .first_not_outdated = 0, .outdated_count = 0, .next_id = 1000000 };
-    Server server = (Server) { .parameters = parameters, .event_array = event_array, .socket_fd = socket_fd,
-            .reservations =  reservations, .time_when_received = current_time };
+// Loads the snapshots of all workers and replays the journals after them, then expires the reservations
+// that timed out while the server was down. Ticket counts are only consistent after all workers are restored.
+void recover_servers(Server *servers, size_t workers, const uint64_t cookie_key[2]) {
+    for (size_t i = 0; i < workers; i++) {
+        JournalHeader header = { .magic = JOURNAL_MAGIC, .version = JOURNAL_VERSION, .worker_id = i,
+                                 .workers = workers, .event_count = servers[i].catalog.count,
+                                 .cookie_key = { cookie_key[0], cookie_key[1] } };
+        servers[i].journal = open_journal(servers[i].parameters.journal_directory, &header);
+        replay_journal(&servers[i], load_snapshot(&servers[i]));
+    }
 
-    return server;
+    for (size_t i = 0; i < workers; i++) {
+        servers[i].time_when_received = time(NULL);
+        check_outdated_reservations(&servers[i], ALL_EXPIRATIONS);
+        commit_journal(&servers[i]);
+        servers[i].next_snapshot_time = servers[i].time_when_received + servers[i].parameters.snapshot_interval;
+    }
+    Catalog *catalog = &servers[0].catalog;
+    for (size_t i = 0; i < catalog->count; i++) {
+        update_events_message(&servers[0], (uint32_t) i);
+    }
+    for (size_t i = 0; i < workers; i++) {
+        log_record(LOG_RECOVERED, i, servers[i].reservations.count);
+    }
 }
 
-#define BUFFER_SIZE 65507
-
-typedef struct __attribute__((__packed__)) EventToSend {
-    uint32_t event_id;
-    uint16_t ticket_count;
-    uint8_t description_length;
-} EventToSend;
-
-void send_events(Server *server, struct sockaddr_in client_address) {
-    char *message = server->message;
-    message[0] = EVENTS;
-    size_t index = 1;
-    EventToSend event_to_send;
+Server *initialize_servers(Parameters parameters) {
+    Catalog catalog = load_catalog_or_exit(parameters.file_ptr);
+    EventsMessage *events_message = build_events_message(&catalog);
+    size_t workers = parameters.workers;
+    uint64_t cookie_key[2];
+    JournalHeader journal_header;
+    char *journal_directory = parameters.journal_directory;
+    if (journal_directory != NULL && read_journal_header(journal_directory, 0, &journal_header)) {
+        memcpy(cookie_key, journal_header.cookie_key, sizeof(cookie_key));
+    }
+    else {
+        ENSURE(getrandom(cookie_key, sizeof(cookie_key), 0) == sizeof(cookie_key));
+    }
 
-    for (size_t i = 0; i < server->event_array.count; i++) {
-        Event *event = server->event_array.arr[i];
-        event_to_send.event_id = htonl(i);
-        event_to_send.ticket_count = htons(event->tickets);
-        event_to_send.description_length = event->description_length;
-        memcpy(message + index, &event_to_send, 7);
+    // Sockets join the SO_REUSEPORT group in the order they are bound, so socket `i` belongs to worker `i`.
+    Server *servers = safe_malloc(workers * sizeof(Server));
+    for (size_t i = 0; i < workers; i++) {
+        int socket_fd = bind_socket(INADDR_ANY, parameters.port, workers > 1);
+        if (parameters.busy_poll > 0) {
+            enable_busy_poll(socket_fd, parameters.busy_poll);
+        }
+        servers[i] = initialize_server(parameters, catalog, events_message, cookie_key, i, socket_fd);
+    }
+    if (workers > 1) {
+        attach_steering_program(servers[0].socket_fd, workers,
+                                node_first_reservation_id(parameters.node, parameters.nodes));
+    }
 
-        index += 7;
-        memcpy(message + index, event->description, event->description_length);
-        index += event->description_length;
+    if (parameters.journal_directory != NULL) {
+        recover_servers(servers, workers, cookie_key);
+    }
+    for (size_t i = 0; i < workers && parameters.trace_directory != NULL; i++) {
+        TraceHeader header = { .magic = TRACE_MAGIC, .version = TRACE_VERSION, .worker_id = (uint32_t) i,
+                               .workers = workers, .cookie_key = { cookie_key[0], cookie_key[1] } };
+        servers[i].trace = open_trace(parameters.trace_directory, &header);
+    }
+    new_reloader(servers, workers, parameters.events_path);
+
+    // Without io_uring support in the kernel all workers stay on the recvmmsg and sendmmsg path.
+    for (size_t i = 0; i < workers && parameters.use_uring; i++) {
+        servers[i].uring = new_uring(&servers[i]);
+        if (servers[i].uring == NULL) {
+            fprintf(stderr, "io_uring is not available, using blocking sockets.\n");
+            for (size_t j = 0; j < i; j++) {
+                destroy_uring(servers[j].uring);
+                servers[j].uring = NULL;
+            }
+            break;
+        }
     }
 
-    send_message(server->socket_fd, &client_address, message, index);
-    print_debug("Events sent.\n");
+    return servers;
 }
 
-void send_bad_request(uint32_t id, int socket_fd, struct sockaddr_in client_address) {
-    char message[5];
-    message[0] = BAD_REQUEST;
-    id = htonl(id);
-    memcpy(message + 1, &id, 4);
-    send_message(socket_fd, &client_address, message, 5);
-    print_debug("Bad request sent.\n");
-}
+// Waits up to the commit window for more datagrams, so that one group commit covers more requests.
+void fill_batch(Server *server) {
+    MessageBatch *batch = &server->incoming;
+    uint64_t deadline_ns = monotonic_ns() + (uint64_t) server->parameters.commit_window * 1000;
 
-char *get_new_cookie(uint32_t reservation_id) {
-    char *cookie = safe_malloc(COOKIE_SIZE * sizeof(char));
-    sprintf(cookie, "%d", reservation_id);
-    size_t len = strlen(cookie);
-    for (size_t i = len - 1; i < COOKIE_SIZE; i++) {
-        cookie[i] = 33 + (rand() % 94);
+    while (batch->count < batch->capacity) {
+        uint64_t now_ns = monotonic_ns();
+        if (now_ns >= deadline_ns) {
+            break;
+        }
+        uint64_t remaining_ns = deadline_ns - now_ns;
+        struct timespec timeout = { .tv_sec = (time_t) (remaining_ns / 1000000000),
+                                    .tv_nsec = (long) (remaining_ns % 1000000000) };
+        struct pollfd poll_fd = { .fd = server->socket_fd, .events = POLLIN };
+        errno = 0;
+        int ready = ppoll(&poll_fd, 1, &timeout, NULL);
+        metric_add(&server->metrics.syscalls, 1);
+        if (ready < 0 && errno != EINTR) {
+            PRINT_ERRNO();
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        errno = 0;
+        int count = recvmmsg(server->socket_fd, batch->headers + batch->count, batch->capacity - batch->count,
+                             MSG_DONTWAIT, NULL);
+        metric_add(&server->metrics.syscalls, 1);
+        if (count < 0 && errno != EAGAIN) {
+            PRINT_ERRNO();
+        }
+        batch->count += count > 0 ? (size_t) count : 0;
     }
-    return cookie;
 }
 
-Reservation *add_new_reservation(Server *server, uint32_t event_id, uint16_t ticket_count) {
-    ReservationsContainer *reservations = &server->reservations;
-    Reservation *reservation = safe_malloc(sizeof(Reservation));
-    uint32_t id = reservations->next_id++;
-    char *cookie = get_new_cookie(id);
-
-    *reservation = (Reservation) { .event_id = event_id, .ticket_count = ticket_count, .reservation_id = id,
-                                   .expiration_time = server->time_when_received + server->parameters.time_limit,
-                                   .first_ticket_id = NO_TICKETS };
-    memcpy(reservation->cookie, cookie, COOKIE_SIZE);
-    free(cookie);
+size_t read_messages(Server *server) {
+    MessageBatch *batch = &server->incoming;
+    for (size_t i = 0; i < batch->capacity; i++) {
+        batch->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->headers[i].msg_hdr.msg_flags = 0;
+    }
 
-    ((Event *) server->event_array.arr[event_id])->tickets -= ticket_count;
+    // The socket is readable, unless a busy polling loop only looks whether it is.
+    errno = 0;
+    int count = recvmmsg(server->socket_fd, batch->headers, batch->capacity, MSG_DONTWAIT, NULL);
+    if (count < 0 && errno != EAGAIN) {
+        PRINT_ERRNO();
+    }
+    metric_add(&server->metrics.syscalls, 1);
+    batch->count = count > 0 ? (size_t) count : 0;
+    if (batch->count == 0) {
+        return 0;
+    }
+    metric_add(&server->metrics.batches, 1);
 
-    add_to_dynamic_array(&reservations->reservations_array, reservation);
-    return reservation;
+    if (server->parameters.commit_window > 0) {
+        fill_batch(server);
+    }
+    return batch->count;
 }
 
-typedef struct __attribute__((__packed__)) ReservationToSend {
-    uint32_t reservation_id;
-    uint32_t event_id;
-    uint16_t ticket_count;
-    char cookie[COOKIE_SIZE];
-    uint64_t expiration_time;
-} ReservationToSend;
-
-void process_reservation(const char *buffer, Server *server, struct sockaddr_in client_address) {
-    print_debug("Processing reservation request...\n");
-    uint32_t event_id;
-    uint16_t ticket_count;
-
-    memcpy(&event_id, buffer, 4);
-    event_id = ntohl(event_id);
-
-    memcpy(&ticket_count, buffer + 4, 2);
-    ticket_count = ntohs(ticket_count);
-
-    if ((ticket_count + 1) * 7 > MAX_MESSAGE_LENGTH) {
-        send_bad_request(event_id, server->socket_fd, client_address);
+void handle_datagrams(void *worker, int socket_fd) {
+    (void) socket_fd;
+    Server *server = worker;
+    MessageBatch *batch = &server->incoming;
+    size_t count = read_messages(server);
+    if (count == 0) {
         return;
     }
 
-    if (event_id >= server->event_array.count || ticket_count == 0) {
-        send_bad_request(event_id, server->socket_fd, client_address);
-        return;
+    for (size_t i = 0; i < count; i++) {
+        struct msghdr *header = &batch->headers[i].msg_hdr;
+        size_t read_length = (header->msg_flags & MSG_TRUNC) ? batch->buffer_size : batch->headers[i].msg_len;
+        process_message(server, batch->buffers + i * batch->buffer_size, read_length, batch->addresses[i]);
     }
-
-    if (((Event *) server->event_array.arr[event_id])->tickets < ticket_count) {
-        send_bad_request(event_id, server->socket_fd, client_address);
-        return;
+    flush_messages(server);
+    if (server->reloader != NULL) {
+        adopt_latest_catalog(server);
+    }
+    if (server->journal != NULL && server->parameters.snapshot_interval > 0) {
+        take_snapshot(server);
     }
 
-    Reservation *reservation = add_new_reservation(server, event_id, ticket_count);
-
-    ReservationToSend reservation_net;
-    memcpy(&reservation_net, reservation, sizeof(ReservationToSend));
-    reservation_net.reservation_id = htonl(reservation_net.reservation_id);
-    reservation_net.event_id = htonl(reservation_net.event_id);
-    reservation_net.ticket_count = htons(reservation_net.ticket_count);
-    reservation_net.expiration_time = htonll(reservation_net.expiration_time);
+    log_record(LOG_BATCH_HANDLED, count, metric_read(&server->metrics.syscalls),
+               metric_requests(&server->metrics));
+}
 
-    size_t message_length = 1 + sizeof(ReservationToSend);
+void handle_housekeeping(void *worker, int timer_fd) {
+    read_timer(timer_fd);
+    run_housekeeping(worker);
+}
 
-    char *message = server->message;
-    message[0] = RESERVATION;
-    memcpy(message + 1, &reservation_net, sizeof(ReservationToSend));
+// Waits for datagrams and for the housekeeping timer, so that expirations and snapshots do not depend on
+// traffic.
+_Noreturn void process_incoming_messages(Server *server) {
+    EventLoop loop = new_event_loop(server->parameters.busy_poll > 0, &server->metrics.syscalls);
+    watch_descriptor(&loop, server->socket_fd, handle_datagrams, server);
+    watch_descriptor(&loop, new_periodic_timer(HOUSEKEEPING_INTERVAL_NS), handle_housekeeping, server);
 
-    send_message(server->socket_fd, &client_address, message, message_length);
-    print_debug("Reservation accepted. Confirmation sent.\n");
+    log_record(LOG_WORKER_LISTENING, server->worker_id, server->parameters.port);
+    run_event_loop(&loop);
 }
 
-void remove_outdated_reservations(ReservationsContainer *reservations, uint64_t current_time) {
-    DynamicArray *array = &reservations->reservations_array;
-    size_t current_index = 0;
-    for (size_t i = 0; i < array->count; i++) {
-        Reservation *reservation = (Reservation *)array->arr[i];
-        if (reservation->first_ticket_id != NO_TICKETS || reservation->expiration_time > current_time) {
-            if (current_index != i) {
-                free(array->arr[current_index]);
-                array->arr[current_index] = reservation;
-                array->arr[i] = NULL;
-            }
-            current_index++;
-        }
+void *run_worker(void *worker) {
+    Server *server = worker;
+    attach_log_ring(server->worker_id);
+    if (server->parameters.first_cpu >= 0) {
+        pin_to_cpu((size_t) server->parameters.first_cpu + server->worker_id);
     }
-
-    for (size_t i = current_index; i < array->count; i++) {
-        if (array->arr[i] != NULL) {
-            free(array->arr[i]);
-        }
+    if (server->uring != NULL) {
+        uring_process_incoming_messages(server);
     }
+    process_incoming_messages(server);
+}
 
-    reservations->reservations_array.count = current_index;
-    reservations->outdated_count = 0;
-    reservations->first_not_outdated = 0;
-    bool do_realloc = false;
+// Counters are summed when a request arrives, the workers are never stopped or locked for it.
+void handle_admin_request(void *admin_server, int socket_fd) {
+    AdminServer *admin = admin_server;
+    char *message = admin->message;
+    char request[16];
+    struct sockaddr_in client_address;
+    socklen_t address_length = sizeof(client_address);
 
-    while (reservations->reservations_array.reserved / 4 > current_index) {
-        reservations->reservations_array.reserved /= 2;
-        do_realloc = true;
+    errno = 0;
+    ssize_t received = recvfrom(socket_fd, request, sizeof(request), 0, (struct sockaddr *) &client_address,
+                                &address_length);
+    if (received < 0) {
+        PRINT_ERRNO();
     }
-
-    if (do_realloc) {
-        if (current_index == 0 && reservations->reservations_array.reserved != 1) {
-            free(reservations->reservations_array.arr);
-            reservations->reservations_array.arr = safe_malloc(sizeof(void *));
-        } else {
-            reservations->reservations_array.arr = safe_realloc(reservations->reservations_array.arr,
-                                                    reservations->reservations_array.reserved * sizeof(void *));
-        }
+    if (received == 6 && memcmp(request, "reload", 6) == 0) {
+        reload_catalog(admin->reloader, message, MAX_MESSAGE_LENGTH);
+        sendto(socket_fd, message, strlen(message), 0, (struct sockaddr *) &client_address, address_length);
+        return;
     }
-}
-
-void check_outdated_reservations(Server *server) {
-    uint64_t current_time = server->time_when_received;
-
-    ReservationsContainer *reservations = &server->reservations;
-    DynamicArray *array = &reservations->reservations_array;
-    for (size_t i = reservations->first_not_outdated; i < array->count; i++) {
-        Reservation *reservation = ((Reservation *)array->arr[i]);
-        if (reservation->expiration_time > current_time) {
-            break;
+    if (received > 4 && memcmp(request, "log ", 4) == 0) {
+        char name[sizeof(request)];
+        memcpy(name, request + 4, (size_t) received - 4);
+        name[received - 4] = '\0';
+        LogLevel level;
+        if (parse_log_level(name, &level)) {
+            set_log_level(level);
+            snprintf(message, MAX_MESSAGE_LENGTH, "log level %s.\n", log_level_name(level));
         }
-        reservations->first_not_outdated++;
-        if (reservation->first_ticket_id == NO_TICKETS) {
-            reservations->outdated_count++;
-            ((Event *) server->event_array.arr[reservation->event_id])->tickets += reservation->ticket_count;
+        else {
+            snprintf(message, MAX_MESSAGE_LENGTH, "unknown log level.\n");
         }
+        sendto(socket_fd, message, strlen(message), 0, (struct sockaddr *) &client_address, address_length);
+        return;
     }
 
-    if (reservations->outdated_count > array->count / 2) {
-        remove_outdated_reservations(reservations, current_time);
+    Metrics total = { 0 };
+    for (size_t i = 0; i < admin->workers; i++) {
+        add_metrics(&total, &admin->servers[i].metrics);
     }
+    metric_add(&total.log_records_dropped, log_records_dropped());
+    // The mutex keeps the version from being freed by a reload meanwhile.
+    CHECK(pthread_mutex_lock(&admin->reloader->mutex));
+    Catalog *catalog = &atomic_load_explicit(&admin->reloader->latest, memory_order_acquire)->catalog;
+    uint64_t tickets_available = count_available_tickets(catalog);
+    CHECK(pthread_mutex_unlock(&admin->reloader->mutex));
+
+    size_t length = format_metrics(message, MAX_MESSAGE_LENGTH, &total, admin->workers, tickets_available);
+    sendto(socket_fd, message, length, 0, (struct sockaddr *) &client_address, address_length);
 }
 
-Reservation *find_reservation(ReservationsContainer *reservations, uint32_t reservation_id, char *cookie) {
-    DynamicArray *array = &reservations->reservations_array;
-    if (array->count == 0) {
-        return NULL;
-    }
-
-    long long begin = 0;
-    long long end = (int) array->count - 1;
-    long long mid = (begin + end) / 2;
-    Reservation *reservation;
-
-    do {
-        reservation = array->arr[mid];
-        if (reservation->reservation_id == reservation_id) {
-            break;
-        }
-        if (reservation->reservation_id < reservation_id) {
-            begin = mid + 1;
-        }
-        else if (reservation->reservation_id > reservation_id) {
-            end = mid - 1;
-        }
-        mid = (begin + end) / 2;
-    } while (end > 0 && begin < (long long) (array->count - 1));
-
-    reservation = array->arr[mid];
-    if (reservation->reservation_id == reservation_id && memcmp(reservation->cookie, cookie, COOKIE_SIZE) == 0) {
-        return reservation;
+void handle_hangup(void *admin_server, int signal_fd) {
+    AdminServer *admin = admin_server;
+    struct signalfd_siginfo signal_info;
+    errno = 0;
+    if (read(signal_fd, &signal_info, sizeof(signal_info)) < 0 && errno != EAGAIN) {
+        PRINT_ERRNO();
     }
-    return NULL;
+    reload_catalog(admin->reloader, admin->message, MAX_MESSAGE_LENGTH);
+    fputs(admin->message, stderr);
 }
 
-void ticket_id_to_str(char *str, int64_t id) {
-    for (size_t i = 0; i < 7; i++) {
-        char temp = (char) (id % 36);
-        str[i] = temp < 10 ? (48 + temp) : (55 + temp);
-        id /= 36;
+_Noreturn void *run_control(void *admin_server) {
+    AdminServer *admin = admin_server;
+    EventLoop loop = new_event_loop(false, NULL);
+    watch_descriptor(&loop, new_signal_descriptor(SIGHUP), handle_hangup, admin);
+    if (admin->socket_fd >= 0) {
+        watch_descriptor(&loop, admin->socket_fd, handle_admin_request, admin);
+        log_record(LOG_METRICS_LISTENING, admin->servers[0].parameters.admin_port);
     }
+    run_event_loop(&loop);
 }
 
-void process_tickets(const char *buffer, Server *server, struct sockaddr_in client_address) {
-    print_debug("Processing requested tickets...\n");
-    uint32_t reservation_id;
-    char cookie[COOKIE_SIZE];
-
-    memcpy(&reservation_id, buffer, 4);
-    reservation_id = ntohl(reservation_id);
-
-    memcpy(&cookie, buffer + 4, COOKIE_SIZE);
-
-    Reservation *reservation = find_reservation(&server->reservations, reservation_id, cookie);
-    if (reservation == NULL || (reservation->first_ticket_id == NO_TICKETS
-        && reservation->expiration_time < server->time_when_received)) {
-        send_bad_request(reservation_id, server->socket_fd, client_address);
-        return;
-    }
-    uint16_t ticket_count = reservation->ticket_count;
-
-    if (reservation->first_ticket_id == NO_TICKETS) {
-        reservation->first_ticket_id = server->next_ticket_id;
-        server->next_ticket_id += ticket_count;
-    }
-
-    size_t message_length = 7 + 7 * ticket_count;
-    char *message = server->message;
-    message[0] = TICKETS;
-
-    for (size_t i = 0; i < ticket_count; i++) {
-        ticket_id_to_str(message + 7 * (i + 1), reservation->first_ticket_id + (int64_t) i);
+// SIGHUP must already be blocked in every thread, so that it is only read by the control thread.
+void start_control_thread(AdminServer *admin) {
+    admin->message = safe_malloc(MAX_MESSAGE_LENGTH);
+    if (admin->servers[0].parameters.admin_port >= 0) {
+        admin->socket_fd = bind_socket(INADDR_LOOPBACK, admin->servers[0].parameters.admin_port, false);
     }
 
-    reservation_id = htonl(reservation_id);
-    ticket_count = htons(ticket_count);
-
-    memcpy(message + 1, &reservation_id, 4);
-    memcpy(message + 5, &ticket_count, 2);
-
-    send_message(server->socket_fd, &client_address, message, message_length);
-    print_debug("Tickets sent.\n");
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, run_control, admin));
+    CHECK(pthread_detach(thread));
 }
 
-void destroy_server(Server *server) {
-    for (size_t i = 0; i < server->event_array.count; i++) {
-        Event *event = server->event_array.arr[i];
-        free(event->description);
+int main(int argc, char *argv[]) {
+    Parameters parameters = parse_args(argc, argv);
+    if (parameters.catalog_path != NULL) {
+        compile_events_file(&parameters);
+        return 0;
+    }
+    if (parameters.replay_path != NULL) {
+        set_log_level(parameters.log_level);
+        replay_trace(&parameters);
+        return 0;
     }
 
-    destroy_dynamic_array(&server->event_array);
-    destroy_dynamic_array(&server->reservations.reservations_array);
-    free(server->event_array.arr);
-    free(server->reservations.reservations_array.arr);
-}
-
-_Noreturn void process_incoming_messages(Server *server) {
-    char buffer[BUFFER_SIZE];
-    struct sockaddr_in client_address;
-    size_t read_length;
-
-    print_debug("Listening on port %u\n", server->parameters.port);
-    while (true) {
-        read_length = read_message(server->socket_fd, &client_address, buffer, sizeof(buffer));
-
-        char *client_ip = inet_ntoa(client_address.sin_addr);
-        uint16_t client_port = ntohs(client_address.sin_port);
-        server->time_when_received = time(NULL);
-
-        print_debug("Received %zd bytes from client %s:%u at time: %ld\n", read_length, client_ip, client_port,
-                    server->time_when_received);
-
-        check_outdated_reservations(server);
+    // Threads inherit the mask, so SIGHUP is only ever read from the signalfd of the control thread.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    CHECK(pthread_sigmask(SIG_BLOCK, &signals, NULL));
+
+    set_log_level(parameters.log_level);
+    start_logger(parameters.workers);
+    Server *servers = initialize_servers(parameters);
+    size_t workers = servers[0].parameters.workers;
+    Reloader *reloader = servers[0].reloader;
+
+    AdminServer admin = { .servers = servers, .workers = workers, .reloader = reloader, .socket_fd = -1,
+                          .message = NULL };
+    start_control_thread(&admin);
+
+    for (size_t i = 1; i < workers; i++) {
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, run_worker, &servers[i]));
+        CHECK(pthread_detach(thread));
+    }
+    run_worker(&servers[0]);
 
-        if (buffer[0] == GET_EVENTS && read_length == GET_EVENTS_MESSAGE_SIZE) {
-            send_events(server, client_address);
-        }
-        else if (buffer[0] == GET_RESERVATION && read_length == GET_RESERVATION_MESSAGE_SIZE) {
-            process_reservation(buffer + 1, server, client_address);
+    for (size_t i = 0; i < workers; i++) {
+        if (servers[i].uring != NULL) {
+            destroy_uring(servers[i].uring);
         }
-        else if (buffer[0] == GET_TICKETS && read_length == GET_TICKETS_MESSAGE_SIZE) {
-            process_tickets(buffer + 1, server, client_address);
+        if (servers[i].journal != NULL) {
+            destroy_journal(servers[i].journal);
         }
-        else {
-            print_debug("Improper message format.\n");
+        if (servers[i].trace != NULL) {
+            destroy_trace(servers[i].trace);
         }
+        destroy_server(&servers[i]);
+        CHECK_ERRNO(close(servers[i].socket_fd));
     }
-}
-
-int main(int argc, char *argv[]) {
-    Server server = initialize_server(argc, argv);
-
-    process_incoming_messages(&server);
-    destroy_server(&server);
-    CHECK_ERRNO(close(server.socket_fd));
+    destroy_reloader(reloader);
+    free(servers);
 
     return 0;
 }
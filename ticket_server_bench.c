@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <inttypes.h>
+
+#include "server.h"
+
+// Microbenchmarks of the server's hot functions. Every result is printed as one JSON object per line,
+// so that runs from different commits can be compared by a script. An optional argument selects the
+// benchmarks whose names contain it.
+
+// As many as fit in the EVENTS message.
+#define EVENT_COUNT 1500
+#define LOOKUP_SAMPLE 4096
+
+static volatile uint64_t sink;
+
+static void report(const char *benchmark, size_t size, size_t operations, uint64_t elapsed_ns) {
+    printf("{\"benchmark\": \"%s\", \"size\": %zu, \"operations\": %zu, \"ns_per_operation\": %.2f}\n",
+           benchmark, size, operations, (double) elapsed_ns / (double) operations);
+    fflush(stdout);
+}
+
+static bool selected(const char *benchmark, const char *filter) {
+    return filter == NULL || strstr(benchmark, filter) != NULL;
+}
+
+// Events file contents, in an anonymous mapping so that the parsed catalog can own it.
+static Catalog new_catalog(size_t count) {
+    size_t capacity = count * 40;
+    char *text = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ENSURE(text != MAP_FAILED);
+
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        length += (size_t) snprintf(text + length, capacity - length, "benchmark event number %zu\n65535\n", i);
+    }
+
+    Catalog catalog;
+    const char *error;
+    ENSURE(parse_events(text, length, &catalog, &error) && catalog.count == count);
+    catalog.mapping = text;
+    catalog.mapping_size = capacity;
+    return catalog;
+}
+
+static Server new_server(Catalog catalog, int time_limit) {
+    uint64_t cookie_key[2];
+    ENSURE(getrandom(cookie_key, sizeof(cookie_key), 0) == sizeof(cookie_key));
+    Parameters parameters = { .file_ptr = NULL, .port = 0, .time_limit = time_limit, .batch_size = 1,
+                              .workers = 1 };
+    return initialize_server(parameters, catalog, build_events_message(&catalog), cookie_key, 0, -1);
+}
+
+static void free_server(Server *server) {
+    destroy_events_message(server->events_message);
+    destroy_catalog(&server->catalog);
+    destroy_server(server);
+}
+
+// Replies are dropped instead of sent, only the work that produces them is measured.
+static void drop_replies(Server *server) {
+    server->outgoing.count = 0;
+    server->events_message_queued = false;
+}
+
+static void bench_events(const char *filter) {
+    Catalog catalog = new_catalog(EVENT_COUNT);
+    Server server = new_server(catalog, 5);
+    struct sockaddr_in client_address = { .sin_family = AF_INET };
+
+    if (selected("build_events_message", filter)) {
+        size_t operations = 2000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            EventsMessage *events_message = build_events_message(&catalog);
+            sink += events_message->length;
+            destroy_events_message(events_message);
+        }
+        report("build_events_message", EVENT_COUNT, operations, monotonic_ns() - start);
+    }
+
+    if (selected("send_events", filter)) {
+        size_t operations = 10000000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            send_events(&server, client_address);
+            drop_replies(&server);
+        }
+        report("send_events", EVENT_COUNT, operations, monotonic_ns() - start);
+    }
+
+    if (selected("send_events_page", filter)) {
+        size_t operations = 10000000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            send_events_page(&server, i % EVENT_COUNT, client_address);
+            drop_replies(&server);
+        }
+        report("send_events_page", EVENT_COUNT, operations, monotonic_ns() - start);
+    }
+
+    if (selected("update_events_message", filter)) {
+        size_t operations = 10000000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            update_events_message(&server, i % EVENT_COUNT);
+        }
+        report("update_events_message", EVENT_COUNT, operations, monotonic_ns() - start);
+    }
+
+    // A reload that appends one event, last because it moves the descriptions of the catalog to the message.
+    if (selected("merge_catalog", filter)) {
+        size_t operations = 2000;
+        uint64_t elapsed_ns = 0;
+        for (size_t i = 0; i < operations; i++) {
+            Catalog next = new_catalog(EVENT_COUNT + 1);
+            uint64_t start = monotonic_ns();
+            EventsMessage *merged_message = merge_catalog(&catalog, server.events_message, &next);
+            elapsed_ns += monotonic_ns() - start;
+            sink += merged_message->length;
+            destroy_events_message(merged_message);
+            free(next.configured_tickets);
+        }
+        report("merge_catalog", EVENT_COUNT, operations, elapsed_ns);
+    }
+
+    free_server(&server);
+}
+
+// Passes over a catalog larger than the caches: the availability scan of the admin endpoint, the refresh of
+// all counts when a worker adopts a reloaded catalog, and reservations of random events.
+static void bench_large_catalog(const char *filter, size_t count) {
+    if (!selected("large_catalog", filter)) {
+        return;
+    }
+    Catalog catalog = new_catalog(count);
+    Server server = new_server(catalog, 5);
+
+    size_t operations = 200;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        sink += count_available_tickets(&server.catalog);
+    }
+    report("large_catalog_count_available_tickets", count, operations * count, monotonic_ns() - start);
+
+    start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        for (size_t event_id = 0; event_id < count; event_id++) {
+            update_events_message(&server, (uint32_t) event_id);
+        }
+    }
+    report("large_catalog_update_all_events", count, operations * count, monotonic_ns() - start);
+
+    operations = 10000000;
+    uint64_t state = 88172645463325252ULL;
+    start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t event_id = (uint32_t) (state % count);
+        ENSURE(take_tickets(&server.catalog, event_id, 1));
+        update_events_message(&server, event_id);
+        return_tickets(&server.catalog, event_id, 1);
+        update_events_message(&server, event_id);
+    }
+    report("large_catalog_random_reservation", count, operations, monotonic_ns() - start);
+
+    operations = 20;
+    start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        EventsMessage *events_message = build_events_message(&server.catalog);
+        sink += events_message->length;
+        destroy_events_message(events_message);
+    }
+    report("large_catalog_build_events_message", count, operations, monotonic_ns() - start);
+
+    free_server(&server);
+}
+
+static void bench_reservations(const char *filter, size_t size) {
+    if (!selected("add_new_reservation", filter) && !selected("find_reservation", filter)) {
+        return;
+    }
+
+    Catalog catalog = new_catalog(EVENT_COUNT);
+    Server server = new_server(catalog, 86400);
+    server.time_when_received = time(NULL);
+
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < size; i++) {
+        add_new_reservation(&server, i % EVENT_COUNT, 1);
+    }
+    if (selected("add_new_reservation", filter)) {
+        report("add_new_reservation", size, size, monotonic_ns() - start);
+    }
+
+    if (selected("find_reservation", filter)) {
+        static uint32_t ids[LOOKUP_SAMPLE];
+        static char cookies[LOOKUP_SAMPLE][COOKIE_SIZE];
+        ReservationsContainer *reservations = &server.reservations;
+        uint64_t random_state = 88172645463325252ULL;
+
+        for (size_t i = 0; i < LOOKUP_SAMPLE; i++) {
+            random_state ^= random_state << 13;
+            random_state ^= random_state >> 7;
+            random_state ^= random_state << 17;
+            ids[i] = reservation_id_of(reservations, random_state % size);
+            compute_cookie(cookies[i], reservations->cookie_key, get_reservation(reservations, ids[i]));
+        }
+
+        size_t operations = 4000000;
+        start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            size_t index = i % LOOKUP_SAMPLE;
+            sink += find_reservation(reservations, ids[index], cookies[index]) != NULL;
+        }
+        report("find_reservation", size, operations, monotonic_ns() - start);
+    }
+
+    free_server(&server);
+}
+
+// Every client sends its GET_RESERVATION again, all of them are answered from the retransmission cache.
+static void bench_replayed_reservations(const char *filter, size_t clients) {
+    if (!selected("replayed_reservation", filter)) {
+        return;
+    }
+
+    Catalog catalog = new_catalog(EVENT_COUNT);
+    uint64_t cookie_key[2] = { 0 };
+    Parameters parameters = { .file_ptr = NULL, .port = 0, .time_limit = 5, .batch_size = 1, .workers = 1,
+                              .retransmission_window = 2 };
+    Server server = initialize_server(parameters, catalog, build_events_message(&catalog), cookie_key, 0, -1);
+    server.time_when_received = time(NULL);
+
+    char request[6];
+    struct sockaddr_in client_address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    for (size_t i = 0; i < clients; i++) {
+        uint32_t event_id = htonl((uint32_t) (i % EVENT_COUNT));
+        uint16_t ticket_count = htons(1);
+        memcpy(request, &event_id, 4);
+        memcpy(request + 4, &ticket_count, 2);
+        client_address.sin_port = htons((uint16_t) (1024 + i));
+        process_reservation(request, &server, client_address);
+        drop_replies(&server);
+    }
+
+    size_t operations = 4000000;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        size_t client = i % clients;
+        uint32_t event_id = htonl((uint32_t) (client % EVENT_COUNT));
+        memcpy(request, &event_id, 4);
+        client_address.sin_port = htons((uint16_t) (1024 + client));
+        process_reservation(request, &server, client_address);
+        drop_replies(&server);
+    }
+    report("replayed_reservation", clients, operations, monotonic_ns() - start);
+    ENSURE(metric_read(&server.metrics.reservations_replayed) == operations);
+
+    free_server(&server);
+}
+
+// Clients asking again for the tickets of picked up reservations of `ticket_count` tickets, with the replies
+// encoded every time or copied from the tickets cache.
+static void bench_repeated_tickets(const char *filter, uint16_t ticket_count, size_t cache_bytes) {
+    const char *benchmark = cache_bytes > 0 ? "cached_tickets" : "encoded_tickets";
+    if (!selected(benchmark, filter)) {
+        return;
+    }
+
+    Catalog catalog = new_catalog(EVENT_COUNT);
+    uint64_t cookie_key[2] = { 0 };
+    Parameters parameters = { .file_ptr = NULL, .port = 0, .time_limit = 5, .batch_size = 1, .workers = 1,
+                              .tickets_cache_bytes = cache_bytes };
+    Server server = initialize_server(parameters, catalog, build_events_message(&catalog), cookie_key, 0, -1);
+    server.time_when_received = time(NULL);
+
+    size_t reservations = 256;
+    char *requests = safe_malloc(reservations * GET_TICKETS_MESSAGE_SIZE);
+    struct sockaddr_in client_address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    for (size_t i = 0; i < reservations; i++) {
+        char request[6];
+        uint32_t event_id = htonl((uint32_t) (i % EVENT_COUNT));
+        uint16_t ticket_count_net = htons(ticket_count);
+        memcpy(request, &event_id, 4);
+        memcpy(request + 4, &ticket_count_net, 2);
+        process_reservation(request, &server, client_address);
+        // The reservation id and the cookie follow the message type.
+        memcpy(requests + i * GET_TICKETS_MESSAGE_SIZE, server.outgoing.buffers + 1, 4);
+        memcpy(requests + i * GET_TICKETS_MESSAGE_SIZE + 4, server.outgoing.buffers + 11, COOKIE_SIZE);
+        drop_replies(&server);
+        process_tickets(requests + i * GET_TICKETS_MESSAGE_SIZE, &server, client_address);
+        drop_replies(&server);
+    }
+
+    size_t operations = 200000;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        process_tickets(requests + (i % reservations) * GET_TICKETS_MESSAGE_SIZE, &server, client_address);
+        sink += (uint8_t) server.outgoing.buffers[7];
+        drop_replies(&server);
+    }
+    report(benchmark, ticket_count, operations, monotonic_ns() - start);
+    ENSURE(cache_bytes == 0 || metric_read(&server.metrics.tickets_cache_hits) == operations);
+
+    free(requests);
+    free_server(&server);
+}
+
+// Sources spread over the address space, with more sources than buckets every lookup replaces one.
+static void bench_rate_limiter(const char *filter, size_t sources) {
+    if (!selected("rate_limit_allows", filter)) {
+        return;
+    }
+
+    RateBudget budgets[RATE_LIMITED_KINDS] = { [REQUEST_GET_EVENTS] = { .rate = 20, .burst = 40 },
+                                               [REQUEST_GET_RESERVATION] = { .rate = 100, .burst = 200 } };
+    RateLimiter limiter = new_rate_limiter(budgets);
+
+    size_t operations = 20000000;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        uint32_t address = (uint32_t) (i % sources) * 2654435761U;
+        sink += rate_limit_allows(&limiter, address, (RequestKind) (i & 1), start + i * 50);
+    }
+    report("rate_limit_allows", sources, operations, monotonic_ns() - start);
+
+    destroy_rate_limiter(&limiter);
+}
+
+// All reservations expire at the same second, the cost is reported per expired reservation.
+static void bench_mass_expiry(const char *filter, size_t size) {
+    if (!selected("check_outdated_reservations", filter)) {
+        return;
+    }
+
+    Catalog catalog = new_catalog(EVENT_COUNT);
+    Server server = new_server(catalog, 5);
+    uint64_t current_time = time(NULL);
+    server.time_when_received = current_time;
+
+    for (size_t i = 0; i < size; i++) {
+        uint32_t event_id = i % EVENT_COUNT;
+        if (!take_tickets(&server.catalog, event_id, 1)) {
+            return_tickets(&server.catalog, event_id, 65535 - available_tickets(&server.catalog, event_id));
+            ENSURE(take_tickets(&server.catalog, event_id, 1));
+        }
+        add_new_reservation(&server, i % EVENT_COUNT, 1);
+    }
+
+    server.time_when_received = current_time + server.parameters.time_limit;
+    uint64_t start = monotonic_ns();
+    check_outdated_reservations(&server, ALL_EXPIRATIONS);
+    report("check_outdated_reservations", size, size, monotonic_ns() - start);
+    ENSURE(server.reservations.count == 0);
+
+    free_server(&server);
+}
+
+static uint64_t load_time_ns(const char *path, size_t operations) {
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < operations; i++) {
+        FILE *file_ptr = fopen(path, "r");
+        ENSURE(file_ptr != NULL);
+        Catalog catalog = load_catalog_or_exit(file_ptr);
+        EventsMessage *events_message = build_events_message(&catalog);
+        sink += events_message->length;
+        destroy_events_message(events_message);
+        destroy_catalog(&catalog);
+    }
+    return monotonic_ns() - start;
+}
+
+// Startup cost of the server, from opening the events file to an EVENTS message ready to send.
+static void bench_catalog_loading(const char *filter) {
+    if (!selected("load_catalog", filter)) {
+        return;
+    }
+
+    char text_path[] = "/tmp/ticket_server_bench_XXXXXX";
+    int fd = mkstemp(text_path);
+    ENSURE(fd >= 0);
+    FILE *file_ptr = fdopen(fd, "w");
+    for (size_t i = 0; i < EVENT_COUNT; i++) {
+        fprintf(file_ptr, "benchmark event number %zu\n65535\n", i);
+    }
+    ENSURE(fclose(file_ptr) == 0);
+
+    char compiled_path[sizeof(text_path) + 9];
+    snprintf(compiled_path, sizeof(compiled_path), "%s.compiled", text_path);
+    file_ptr = fopen(text_path, "r");
+    ENSURE(file_ptr != NULL);
+    Catalog catalog = load_catalog_or_exit(file_ptr);
+    EventsMessage *events_message = build_events_message(&catalog);
+    compile_catalog(&catalog, events_message, compiled_path);
+    destroy_events_message(events_message);
+    destroy_catalog(&catalog);
+
+    size_t operations = 20000;
+    report("load_catalog_text", EVENT_COUNT, operations, load_time_ns(text_path, operations));
+    report("load_catalog_compiled", EVENT_COUNT, operations, load_time_ns(compiled_path, operations));
+
+    CHECK_ERRNO(unlink(text_path));
+    CHECK_ERRNO(unlink(compiled_path));
+}
+
+static void bench_ticket_codes(const char *filter) {
+    static char message[MAX_MESSAGE_LENGTH];
+    size_t ticket_count = (MAX_MESSAGE_LENGTH - 7) / 7;
+
+    if (selected("ticket_id_to_str", filter)) {
+        size_t operations = 100000000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            ticket_id_to_str(message + 7 * (i % ticket_count), (int64_t) i);
+        }
+        sink += message[0];
+        report("ticket_id_to_str", 1, operations, monotonic_ns() - start);
+    }
+
+    if (selected("encode_ticket_range", filter)) {
+        size_t operations = 20000;
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < operations; i++) {
+            encode_ticket_range(message, (int64_t) (i * ticket_count), ticket_count);
+        }
+        sink += message[0];
+        report("encode_ticket_range", ticket_count, operations, monotonic_ns() - start);
+    }
+}
+
+// Compares the range encoding with one code at a time, byte for byte. Ranges start just before every carry
+// of every digit, including the wrap of the ticket id space, and cover the first 36^4 ids exhaustively.
+static bool ticket_range_matches(int64_t first_ticket_id, size_t count) {
+    static char range[MAX_MESSAGE_LENGTH];
+    static char expected[MAX_MESSAGE_LENGTH];
+    encode_ticket_range(range, first_ticket_id, count);
+    for (size_t i = 0; i < count; i++) {
+        ticket_id_to_str(expected + 7 * i, first_ticket_id + (int64_t) i);
+    }
+    if (memcmp(range, expected, 7 * count) != 0) {
+        fprintf(stderr, "encode_ticket_range(%" PRId64 ", %zu) differs from ticket_id_to_str\n",
+                first_ticket_id, count);
+        return false;
+    }
+    return true;
+}
+
+static int check_ticket_codes(void) {
+    size_t count = MAX_TICKETS_PER_MESSAGE;
+    size_t failures = 0;
+    size_t ranges = 0;
+
+    for (int64_t first = 0; first < 36 * 36 * 36 * 36; first += (int64_t) count) {
+        failures += !ticket_range_matches(first, count);
+        ranges++;
+    }
+
+    const int64_t offsets[] = { 0, 1, 2, 7, 35, 36, 37, 1000, (int64_t) MAX_TICKETS_PER_MESSAGE - 1 };
+    int64_t power = 1;
+    for (size_t digit = 1; digit <= 7; digit++) {
+        power *= 36;
+        // The last digit only carries into the wrap back to 0000000.
+        int64_t multiples = digit == 7 ? 1 : 35;
+        for (int64_t multiple = 1; multiple <= multiples; multiple++) {
+            for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+                int64_t first = multiple * power - offsets[i];
+                if (first < 0) {
+                    continue;
+                }
+                failures += !ticket_range_matches(first, count);
+                failures += !ticket_range_matches(first, 1 + (size_t) offsets[i] % count);
+                ranges += 2;
+            }
+        }
+    }
+
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < 10000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        failures += !ticket_range_matches((int64_t) (state % TICKET_ID_SPACE), 1 + (size_t) (state >> 40) % count);
+        ranges++;
+    }
+
+    printf("encode_ticket_range: %zu ranges checked, %zu differ\n", ranges, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// With --check the outputs of the optimized functions are checked instead of timed.
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--check") == 0) {
+        return check_ticket_codes();
+    }
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    bench_events(filter);
+    bench_large_catalog(filter, 100000);
+    bench_reservations(filter, 1000);
+    bench_reservations(filter, 1000000);
+    bench_reservations(filter, 10000000);
+    bench_mass_expiry(filter, 1000000);
+    bench_replayed_reservations(filter, 1000);
+    bench_repeated_tickets(filter, 16, 0);
+    bench_repeated_tickets(filter, 16, DEFAULT_TICKETS_CACHE_BYTES);
+    bench_repeated_tickets(filter, 9357, 0);
+    bench_repeated_tickets(filter, 9357, DEFAULT_TICKETS_CACHE_BYTES);
+    bench_rate_limiter(filter, 1000);
+    bench_rate_limiter(filter, 100000);
+    bench_catalog_loading(filter);
+    bench_ticket_codes(filter);
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include "tickets_cache.h"
+#include "server.h"
+
+TicketsCache new_tickets_cache(size_t max_bytes) {
+    TicketsCache cache = { .entries = safe_malloc(TICKETS_CACHE_ENTRIES * sizeof(TicketsCacheEntry)),
+                           .index = safe_malloc(TICKETS_CACHE_INDEX_SIZE * sizeof(uint32_t)),
+                           .newest = NO_TICKETS_CACHE_ENTRY, .oldest = NO_TICKETS_CACHE_ENTRY, .used = 0,
+                           .free = NO_TICKETS_CACHE_ENTRY, .bytes = 0, .max_bytes = max_bytes };
+    memset(cache.index, 0xff, TICKETS_CACHE_INDEX_SIZE * sizeof(uint32_t));
+    return cache;
+}
+
+void destroy_tickets_cache(TicketsCache *cache) {
+    if (cache->entries == NULL) {
+        return;
+    }
+    for (uint32_t entry = cache->newest; entry != NO_TICKETS_CACHE_ENTRY; entry = cache->entries[entry].older) {
+        free(cache->entries[entry].message);
+    }
+    free(cache->entries);
+    free(cache->index);
+    cache->entries = NULL;
+    cache->index = NULL;
+}
+
+static inline size_t index_slot(uint32_t reservation_id) {
+    return (uint32_t) (reservation_id * 2654435761U) >> (32 - TICKETS_CACHE_INDEX_BITS);
+}
+
+// Returns the slot of the index holding the reservation, or the empty slot where it would be.
+static size_t find_slot(const TicketsCache *cache, uint32_t reservation_id) {
+    size_t slot = index_slot(reservation_id);
+    while (cache->index[slot] != NO_TICKETS_CACHE_ENTRY
+           && cache->entries[cache->index[slot]].reservation_id != reservation_id) {
+        slot = (slot + 1) & (TICKETS_CACHE_INDEX_SIZE - 1);
+    }
+    return slot;
+}
+
+// Empties the slot, moving back the entries after it that would not be found past the gap otherwise.
+static void remove_slot(TicketsCache *cache, size_t slot) {
+    size_t gap = slot;
+    cache->index[gap] = NO_TICKETS_CACHE_ENTRY;
+    for (size_t next = (gap + 1) & (TICKETS_CACHE_INDEX_SIZE - 1); cache->index[next] != NO_TICKETS_CACHE_ENTRY;
+         next = (next + 1) & (TICKETS_CACHE_INDEX_SIZE - 1)) {
+        size_t home = index_slot(cache->entries[cache->index[next]].reservation_id);
+        // Whether `home` lies cyclically in (gap, next], then the entry stays.
+        if (((next - home) & (TICKETS_CACHE_INDEX_SIZE - 1)) < ((next - gap) & (TICKETS_CACHE_INDEX_SIZE - 1))) {
+            continue;
+        }
+        cache->index[gap] = cache->index[next];
+        cache->index[next] = NO_TICKETS_CACHE_ENTRY;
+        gap = next;
+    }
+}
+
+static void unlink_entry(TicketsCache *cache, uint32_t entry) {
+    TicketsCacheEntry *cached = &cache->entries[entry];
+    if (cached->newer != NO_TICKETS_CACHE_ENTRY) {
+        cache->entries[cached->newer].older = cached->older;
+    }
+    else {
+        cache->newest = cached->older;
+    }
+    if (cached->older != NO_TICKETS_CACHE_ENTRY) {
+        cache->entries[cached->older].newer = cached->newer;
+    }
+    else {
+        cache->oldest = cached->newer;
+    }
+}
+
+static void link_newest(TicketsCache *cache, uint32_t entry) {
+    cache->entries[entry].newer = NO_TICKETS_CACHE_ENTRY;
+    cache->entries[entry].older = cache->newest;
+    if (cache->newest != NO_TICKETS_CACHE_ENTRY) {
+        cache->entries[cache->newest].newer = entry;
+    }
+    else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+static void evict_oldest(TicketsCache *cache) {
+    uint32_t entry = cache->oldest;
+    TicketsCacheEntry *cached = &cache->entries[entry];
+    remove_slot(cache, find_slot(cache, cached->reservation_id));
+    unlink_entry(cache, entry);
+    cache->bytes -= cached->length;
+    free(cached->message);
+    cached->older = cache->free;
+    cache->free = entry;
+}
+
+const TicketsCacheEntry *find_cached_tickets(TicketsCache *cache, uint32_t reservation_id) {
+    uint32_t entry = cache->index[find_slot(cache, reservation_id)];
+    if (entry == NO_TICKETS_CACHE_ENTRY) {
+        return NULL;
+    }
+    if (cache->newest != entry) {
+        unlink_entry(cache, entry);
+        link_newest(cache, entry);
+    }
+    return &cache->entries[entry];
+}
+
+// Keeps a copy of the reply, unless it is larger than the whole cache.
+void cache_tickets(TicketsCache *cache, uint32_t reservation_id, const char *message, size_t length) {
+    if (length > cache->max_bytes) {
+        return;
+    }
+    while (cache->newest != NO_TICKETS_CACHE_ENTRY
+           && (cache->bytes + length > cache->max_bytes
+               || (cache->free == NO_TICKETS_CACHE_ENTRY && cache->used == TICKETS_CACHE_ENTRIES))) {
+        evict_oldest(cache);
+    }
+
+    uint32_t entry;
+    if (cache->free != NO_TICKETS_CACHE_ENTRY) {
+        entry = cache->free;
+        cache->free = cache->entries[entry].older;
+    }
+    else {
+        entry = cache->used++;
+    }
+    TicketsCacheEntry *cached = &cache->entries[entry];
+    cached->message = safe_malloc(length);
+    memcpy(cached->message, message, length);
+    cached->length = (uint32_t) length;
+    cached->reservation_id = reservation_id;
+    cache->bytes += length;
+    cache->index[find_slot(cache, reservation_id)] = entry;
+    link_newest(cache, entry);
+}
@@ -0,0 +1,44 @@
+#ifndef _TICKETS_CACHE_
+#define _TICKETS_CACHE_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// TICKETS replies each worker can keep, and the slots of the index, a power of two at least twice as many.
+#define TICKETS_CACHE_ENTRIES 32768
+#define TICKETS_CACHE_INDEX_BITS 16
+#define TICKETS_CACHE_INDEX_SIZE (1 << TICKETS_CACHE_INDEX_BITS)
+// Smaller replies are encoded again faster than they are looked up.
+#define TICKETS_CACHE_MIN_TICKETS 8
+#define DEFAULT_TICKETS_CACHE_BYTES (16 << 20)
+#define NO_TICKETS_CACHE_ENTRY UINT32_MAX
+
+typedef struct TicketsCacheEntry {
+    char *message;
+    uint32_t length;
+    uint32_t reservation_id;
+    // Neighbours on the list from the most to the least recently used entry.
+    uint32_t newer;
+    uint32_t older;
+} TicketsCacheEntry;
+
+// Encoded TICKETS replies of picked up reservations, by reservation id, for clients asking for their tickets
+// again. The least recently used replies are dropped to keep the messages within `max_bytes`.
+typedef struct TicketsCache {
+    TicketsCacheEntry *entries;
+    // Entry of each reservation id, open-addressed with linear probing.
+    uint32_t *index;
+    uint32_t newest;
+    uint32_t oldest;
+    uint32_t used;
+    uint32_t free;
+    size_t bytes;
+    size_t max_bytes;
+} TicketsCache;
+
+TicketsCache new_tickets_cache(size_t max_bytes);
+void destroy_tickets_cache(TicketsCache *cache);
+const TicketsCacheEntry *find_cached_tickets(TicketsCache *cache, uint32_t reservation_id);
+void cache_tickets(TicketsCache *cache, uint32_t reservation_id, const char *message, size_t length);
+
+#endif // _TICKETS_CACHE_
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// Creates the trace of the worker named in the header, a trace left by an earlier run is overwritten.
+Trace *open_trace(const char *directory, const TraceHeader *header) {
+    char path[PATH_MAX];
+    int length = snprintf(path, PATH_MAX, "%s/trace.%u", directory, header->worker_id);
+    if (length < 0 || length >= PATH_MAX) {
+        fatal("trace path is too long.");
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        PRINT_ERRNO();
+    }
+    ENSURE(write(fd, header, sizeof(TraceHeader)) == sizeof(TraceHeader));
+
+    Trace *trace = safe_malloc(sizeof(Trace));
+    *trace = (Trace) { .fd = fd, .buffer = safe_malloc(TRACE_INITIAL_CAPACITY), .length = 0,
+                       .capacity = TRACE_INITIAL_CAPACITY };
+    return trace;
+}
+
+void destroy_trace(Trace *trace) {
+    write_trace(trace);
+    CHECK_ERRNO(close(trace->fd));
+    free(trace->buffer);
+    free(trace);
+}
+
+void append_trace_record(Trace *trace, uint64_t time_ns, uint64_t time, const char *buffer, size_t length,
+                         const struct sockaddr_in *client_address) {
+    while (trace->length + sizeof(TraceRecord) + length > trace->capacity) {
+        trace->capacity *= 2;
+        trace->buffer = safe_realloc(trace->buffer, trace->capacity);
+    }
+    TraceRecord record = { .time_ns = time_ns, .time = (uint32_t) time, .address = client_address->sin_addr.s_addr,
+                           .port = client_address->sin_port, .length = (uint16_t) length };
+    memcpy(trace->buffer + trace->length, &record, sizeof(record));
+    memcpy(trace->buffer + trace->length + sizeof(record), buffer, length);
+    trace->length += sizeof(record) + length;
+}
+
+// Without fdatasync, a trace only has to survive the process, not the machine.
+void write_trace(Trace *trace) {
+    size_t written = 0;
+    while (written < trace->length) {
+        errno = 0;
+        ssize_t result = write(trace->fd, trace->buffer + written, trace->length - written);
+        if (result < 0 && errno != EINTR) {
+            PRINT_ERRNO();
+        }
+        written += result > 0 ? (size_t) result : 0;
+    }
+    trace->length = 0;
+}
+
+TraceReplay *open_trace_replay(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        PRINT_ERRNO();
+    }
+    struct stat file_stat;
+    CHECK_ERRNO(fstat(fd, &file_stat));
+    size_t size = (size_t) file_stat.st_size;
+    if (size < sizeof(TraceHeader)) {
+        fatal("trace is corrupted.");
+    }
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ENSURE(data != MAP_FAILED);
+    CHECK_ERRNO(close(fd));
+
+    TraceReplay *replay = safe_malloc(sizeof(TraceReplay));
+    *replay = (TraceReplay) { .data = data, .size = size, .offset = sizeof(TraceHeader),
+                              .digest = FNV_OFFSET_BASIS };
+    memcpy(&replay->header, data, sizeof(TraceHeader));
+    if (replay->header.magic != TRACE_MAGIC || replay->header.version != TRACE_VERSION
+        || replay->header.workers == 0 || replay->header.worker_id >= replay->header.workers) {
+        fatal("trace is corrupted.");
+    }
+    return replay;
+}
+
+void destroy_trace_replay(TraceReplay *replay) {
+    CHECK_ERRNO(munmap(replay->data, replay->size));
+    free(replay);
+}
+
+// Returns NULL after the last record. A record cut by a capture that was killed while writing ends the trace.
+const TraceRecord *next_trace_record(TraceReplay *replay) {
+    if (replay->offset + sizeof(TraceRecord) > replay->size) {
+        return NULL;
+    }
+    const TraceRecord *record = (const TraceRecord *) (replay->data + replay->offset);
+    if (replay->offset + sizeof(TraceRecord) + record->length > replay->size) {
+        return NULL;
+    }
+    replay->offset += sizeof(TraceRecord) + record->length;
+    replay->time_ns = record->time_ns;
+    replay->time = record->time;
+    return record;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Takes the place of sending the batch, every reply is hashed together with its address and length.
+void digest_replies(Server *server) {
+    TraceReplay *replay = server->replay;
+    MessageBatch *batch = &server->outgoing;
+
+    for (size_t i = 0; i < batch->count; i++) {
+        uint64_t length = batch->iovecs[i].iov_len;
+        replay->digest = fnv1a(replay->digest, &batch->addresses[i].sin_addr.s_addr, 4);
+        replay->digest = fnv1a(replay->digest, &batch->addresses[i].sin_port, 2);
+        replay->digest = fnv1a(replay->digest, &length, sizeof(length));
+        replay->digest = fnv1a(replay->digest, batch->iovecs[i].iov_base, length);
+        replay->reply_bytes += length;
+    }
+    replay->replies += batch->count;
+    batch->count = 0;
+    server->events_message_queued = false;
+}
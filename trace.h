@@ -0,0 +1,65 @@
+#ifndef _TRACE_
+#define _TRACE_
+
+#include "server.h"
+
+// "TICKTRC1" read as a little endian integer.
+#define TRACE_MAGIC 0x314352544b434954ULL
+#define TRACE_VERSION 1
+#define TRACE_INITIAL_CAPACITY 65536
+
+// Replies depend on the cookie key and on the worker's share of the reservation and ticket ids, the replay
+// takes them from here. The other parameters have to be given again.
+typedef struct TraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t worker_id;
+    uint64_t workers;
+    uint64_t cookie_key[2];
+} TraceHeader;
+
+// Every datagram a worker received, followed by its `length` bytes. `time_ns` is the monotonic clock the
+// rate limits use and `time` the wall clock of the reservations, both as the worker saw them.
+typedef struct __attribute__((__packed__)) TraceRecord {
+    uint64_t time_ns;
+    uint32_t time;
+    uint32_t address;
+    uint16_t port;
+    uint16_t length;
+} TraceRecord;
+
+// Datagrams of a batch are collected in memory and written together when the batch's replies are sent.
+typedef struct Trace {
+    int fd;
+    char *buffer;
+    size_t length;
+    size_t capacity;
+} Trace;
+
+// A trace mapped for replaying. Replies are folded into `digest` instead of being sent, so two runs of the
+// same trace can be compared byte for byte.
+typedef struct TraceReplay {
+    TraceHeader header;
+    char *data;
+    size_t size;
+    size_t offset;
+    // Clocks of the datagram that is processed.
+    uint64_t time_ns;
+    uint64_t time;
+    uint64_t digest;
+    uint64_t replies;
+    uint64_t reply_bytes;
+} TraceReplay;
+
+Trace *open_trace(const char *directory, const TraceHeader *header);
+void destroy_trace(Trace *trace);
+void append_trace_record(Trace *trace, uint64_t time_ns, uint64_t time, const char *buffer, size_t length,
+                         const struct sockaddr_in *client_address);
+void write_trace(Trace *trace);
+
+TraceReplay *open_trace_replay(const char *path);
+void destroy_trace_replay(TraceReplay *replay);
+const TraceRecord *next_trace_record(TraceReplay *replay);
+void digest_replies(Server *server);
+
+#endif // _TRACE_
@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "journal.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "reload.h"
+#include "event_loop.h"
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+static char *uring_buffer(Uring *uring, uint16_t buffer_id) {
+    return uring->buffers + (size_t) buffer_id * URING_BUFFER_SIZE;
+}
+
+// Gives the buffer back to the kernel, it becomes visible with the next `publish_buffers`.
+static void recycle_buffer(Uring *uring, uint16_t buffer_id) {
+    struct io_uring_buf *buffer = &uring->buffer_ring->bufs[uring->buffer_tail & (URING_BUFFER_COUNT - 1)];
+    buffer->addr = (uint64_t) (uintptr_t) uring_buffer(uring, buffer_id);
+    buffer->len = URING_BUFFER_SIZE;
+    buffer->bid = buffer_id;
+    uring->buffer_tail++;
+}
+
+static void publish_buffers(Uring *uring) {
+    __atomic_store_n(&uring->buffer_ring->tail, uring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+// The kernel reads every submitted request before `io_uring_enter` returns, so the queue is never full
+// when it holds fewer requests than it has entries.
+static struct io_uring_sqe *next_sqe(Uring *uring) {
+    unsigned tail = uring->sq_local_tail++;
+    ENSURE(tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) < uring->sq_entries);
+
+    unsigned index = tail & uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    uring->to_submit++;
+    return sqe;
+}
+
+static void arm_receive(Server *server) {
+    Uring *uring = server->uring;
+    struct io_uring_sqe *sqe = next_sqe(uring);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = server->socket_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->receive_header;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECEIVE_USER_DATA;
+    uring->receive_armed = true;
+}
+
+static void arm_timer(Uring *uring) {
+    struct io_uring_sqe *sqe = next_sqe(uring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = uring->timer_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &uring->timer_expirations;
+    sqe->len = sizeof(uring->timer_expirations);
+    sqe->user_data = URING_TIMER_USER_DATA;
+    uring->timer_armed = true;
+}
+
+// Writes a sendmsg request for every reply queued since the last call, the headers of the outgoing batch
+// already point to the replies and the client addresses.
+static void queue_sends(Server *server) {
+    Uring *uring = server->uring;
+    MessageBatch *batch = &server->outgoing;
+
+    for (; uring->sends_queued < batch->count; uring->sends_queued++) {
+        struct io_uring_sqe *sqe = next_sqe(uring);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = server->socket_fd;
+        sqe->addr = (uint64_t) (uintptr_t) &batch->headers[uring->sends_queued].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = uring->sends_queued;
+        uring->sends_in_flight++;
+    }
+}
+
+// Passes the queued requests to the kernel, waiting for at least `min_complete` completions.
+static void submit_and_wait(Server *server, unsigned min_complete) {
+    Uring *uring = server->uring;
+    if (uring->to_submit == 0 && min_complete == 0) {
+        return;
+    }
+
+    __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+    int submitted;
+    do {
+        errno = 0;
+        submitted = io_uring_enter(uring->ring_fd, uring->to_submit, min_complete,
+                                   min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted < 0) {
+        PRINT_ERRNO();
+    }
+    uring->to_submit -= (unsigned) submitted;
+    metric_add(&server->metrics.syscalls, 1);
+}
+
+static void handle_receive(Server *server, struct io_uring_cqe *cqe) {
+    Uring *uring = server->uring;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring->receive_armed = false;
+    }
+    if (cqe->res < 0) {
+        // Out of buffers, the receive is armed again once some are recycled.
+        if (cqe->res != -ENOBUFS) {
+            errno = -cqe->res;
+            PRINT_ERRNO();
+        }
+        return;
+    }
+
+    ENSURE(cqe->flags & IORING_CQE_F_BUFFER);
+    size_t tail = (uring->datagrams_head + uring->datagrams_count) & (URING_BUFFER_COUNT - 1);
+    uring->datagrams[tail] = (UringDatagram) { .buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT,
+                                               .length = (uint32_t) cqe->res };
+    uring->datagrams_count++;
+}
+
+static void reap_completions(Server *server) {
+    Uring *uring = server->uring;
+    unsigned head = *uring->cq_head;
+    unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+        if (cqe->user_data == URING_RECEIVE_USER_DATA) {
+            handle_receive(server, cqe);
+            continue;
+        }
+        if (cqe->user_data == URING_TIMER_USER_DATA) {
+            uring->timer_armed = false;
+            uring->housekeeping_due = true;
+            continue;
+        }
+        ENSURE(cqe->res >= 0 && (size_t) cqe->res == server->outgoing.iovecs[cqe->user_data].iov_len);
+        uring->sends_in_flight--;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Sends the queued replies and waits until the kernel is done with them, so the outgoing batch can be reused.
+void uring_flush_messages(Server *server) {
+    Uring *uring = server->uring;
+
+    queue_sends(server);
+    while (uring->sends_in_flight > 0) {
+        submit_and_wait(server, 1);
+        reap_completions(server);
+    }
+    uring->sends_queued = 0;
+    server->outgoing.count = 0;
+    server->events_message_queued = false;
+}
+
+Uring *new_uring(Server *server) {
+    size_t sq_entries = 1;
+    while (sq_entries < server->parameters.batch_size + 2) {
+        sq_entries *= 2;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2 * URING_BUFFER_COUNT;
+
+    int ring_fd = io_uring_setup((unsigned) sq_entries, &params);
+    if (ring_fd < 0) {
+        return NULL;
+    }
+    ENSURE(params.features & IORING_FEAT_SINGLE_MMAP);
+
+    Uring *uring = safe_malloc(sizeof(Uring));
+    memset(uring, 0, sizeof(Uring));
+    uring->ring_fd = ring_fd;
+    uring->timer_fd = -1;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    uring->rings = mmap(NULL, uring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQ_RING);
+    ENSURE(uring->rings != MAP_FAILED);
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                       IORING_OFF_SQES);
+    ENSURE(uring->sqes != MAP_FAILED);
+
+    char *rings = uring->rings;
+    uring->sq_head = (unsigned *) (rings + params.sq_off.head);
+    uring->sq_tail = (unsigned *) (rings + params.sq_off.tail);
+    uring->sq_mask = *(unsigned *) (rings + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *) (rings + params.sq_off.array);
+    uring->sq_entries = params.sq_entries;
+    uring->sq_local_tail = *uring->sq_tail;
+    uring->cq_head = (unsigned *) (rings + params.cq_off.head);
+    uring->cq_tail = (unsigned *) (rings + params.cq_off.tail);
+    uring->cq_mask = *(unsigned *) (rings + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (rings + params.cq_off.cqes);
+
+    uring->buffer_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    uring->buffer_ring = mmap(NULL, uring->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                              -1, 0);
+    ENSURE(uring->buffer_ring != MAP_FAILED);
+    uring->buffers = safe_malloc(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+
+    struct io_uring_buf_reg registration = { .ring_addr = (uint64_t) (uintptr_t) uring->buffer_ring,
+                                             .ring_entries = URING_BUFFER_COUNT, .bgid = URING_BUFFER_GROUP };
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        destroy_uring(uring);
+        return NULL;
+    }
+    for (size_t i = 0; i < URING_BUFFER_COUNT; i++) {
+        recycle_buffer(uring, (uint16_t) i);
+    }
+    publish_buffers(uring);
+
+    uring->receive_header.msg_namelen = sizeof(struct sockaddr_in);
+    uring->timer_fd = new_periodic_timer(HOUSEKEEPING_INTERVAL_NS);
+    return uring;
+}
+
+void destroy_uring(Uring *uring) {
+    CHECK_ERRNO(munmap(uring->buffer_ring, uring->buffer_ring_size));
+    CHECK_ERRNO(munmap(uring->sqes, uring->sqes_size));
+    CHECK_ERRNO(munmap(uring->rings, uring->rings_size));
+    CHECK_ERRNO(close(uring->ring_fd));
+    if (uring->timer_fd >= 0) {
+        CHECK_ERRNO(close(uring->timer_fd));
+    }
+    free(uring->buffers);
+    free(uring);
+}
+
+static void process_datagram(Server *server, UringDatagram datagram) {
+    Uring *uring = server->uring;
+    char *buffer = uring_buffer(uring, datagram.buffer_id);
+    struct io_uring_recvmsg_out *header = (struct io_uring_recvmsg_out *) buffer;
+
+    struct sockaddr_in client_address;
+    memcpy(&client_address, buffer + sizeof(*header), sizeof(client_address));
+    char *payload = buffer + sizeof(*header) + uring->receive_header.msg_namelen;
+    size_t read_length = (header->flags & MSG_TRUNC) ? RECEIVE_BUFFER_SIZE : header->payloadlen;
+
+    process_message(server, payload, read_length, client_address);
+    recycle_buffer(uring, datagram.buffer_id);
+}
+
+// Every iteration submits the replies to the previous batch and waits for the next one with a single
+// `io_uring_enter`. The outgoing batch is reused only after the kernel has completed all its sends.
+_Noreturn void uring_process_incoming_messages(Server *server) {
+    Uring *uring = server->uring;
+
+    log_record(LOG_WORKER_LISTENING_URING, server->worker_id, server->parameters.port);
+    while (true) {
+        if (!uring->receive_armed) {
+            arm_receive(server);
+        }
+        if (!uring->timer_armed) {
+            arm_timer(uring);
+        }
+        // Waits for the sends of the previous batch and, with nothing left to process, for a datagram.
+        size_t min_complete = uring->sends_in_flight + (uring->datagrams_count == 0 ? 1 : 0);
+        submit_and_wait(server, (unsigned) min_complete);
+        reap_completions(server);
+        if (uring->sends_in_flight > 0) {
+            continue;
+        }
+        uring->sends_queued = 0;
+        server->outgoing.count = 0;
+        server->events_message_queued = false;
+        if (server->reloader != NULL) {
+            adopt_latest_catalog(server);
+        }
+        if (uring->housekeeping_due) {
+            uring->housekeeping_due = false;
+            run_housekeeping(server);
+        }
+
+        size_t count = 0;
+        while (uring->datagrams_count > 0 && count < server->outgoing.capacity) {
+            UringDatagram datagram = uring->datagrams[uring->datagrams_head];
+            uring->datagrams_head = (uring->datagrams_head + 1) & (URING_BUFFER_COUNT - 1);
+            uring->datagrams_count--;
+            process_datagram(server, datagram);
+            count++;
+        }
+        if (count == 0) {
+            continue;
+        }
+        publish_buffers(server->uring);
+        commit_journal(server);
+        if (server->trace != NULL) {
+            write_trace(server->trace);
+        }
+        queue_sends(server);
+        if (server->journal != NULL && server->parameters.snapshot_interval > 0) {
+            take_snapshot(server);
+        }
+
+        metric_add(&server->metrics.batches, 1);
+        log_record(LOG_BATCH_HANDLED, count, metric_read(&server->metrics.syscalls),
+                   metric_requests(&server->metrics));
+    }
+}
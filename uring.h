@@ -0,0 +1,77 @@
+#ifndef _URING_
+#define _URING_
+
+#include <linux/io_uring.h>
+
+#include "server.h"
+
+// Receive buffers handed to the kernel, a datagram that arrives when all of them are in use waits in the
+// socket until the multishot receive is armed again.
+#define URING_BUFFER_COUNT 4096
+#define URING_BUFFER_GROUP 0
+// Each buffer holds the recvmsg header and the client address followed by the datagram.
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + RECEIVE_BUFFER_SIZE)
+#define URING_RECEIVE_USER_DATA UINT64_MAX
+#define URING_TIMER_USER_DATA (UINT64_MAX - 1)
+
+// Datagram received into a provided buffer and not processed yet.
+typedef struct UringDatagram {
+    uint16_t buffer_id;
+    uint32_t length;
+} UringDatagram;
+
+// io_uring instance of a worker, driven with raw system calls. Datagrams are received by one multishot
+// recvmsg into a ring of provided buffers, replies are submitted as sendmsg requests together with the
+// wait for the next datagrams.
+typedef struct Uring {
+    int ring_fd;
+    void *rings;
+    size_t rings_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sq_entries;
+    // Tail including the requests written to the submission queue and not passed to the kernel yet.
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *buffer_ring;
+    size_t buffer_ring_size;
+    char *buffers;
+    uint16_t buffer_tail;
+
+    struct msghdr receive_header;
+    bool receive_armed;
+
+    // Housekeeping timer, read through the ring so that its expiry ends the wait for datagrams.
+    int timer_fd;
+    uint64_t timer_expirations;
+    bool timer_armed;
+    bool housekeeping_due;
+
+    // FIFO of received datagrams, there cannot be more of them than buffers.
+    UringDatagram datagrams[URING_BUFFER_COUNT];
+    size_t datagrams_head;
+    size_t datagrams_count;
+
+    // Replies of the outgoing batch that have a sendmsg request, and those not completed yet. The batch
+    // is reused only when all of them are completed.
+    size_t sends_queued;
+    size_t sends_in_flight;
+} Uring;
+
+Uring *new_uring(Server *server);
+void destroy_uring(Uring *uring);
+void uring_flush_messages(Server *server);
+_Noreturn void uring_process_incoming_messages(Server *server);
+
+#endif // _URING_